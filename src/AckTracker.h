@@ -0,0 +1,155 @@
+// ***************************************************************
+// AckTracker: commands resent until the other end acknowledges them
+// - header only and free of Arduino, so the same code is tested on the PC against a link that loses packets
+//   (pio test -e native)
+// ***************************************************************
+#ifndef ACK_TRACKER_H
+#define ACK_TRACKER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+template <typename T, uint8_t SLOTS, uint16_t FIRST_MS, uint16_t MAX_MS, uint8_t RETRIES>
+class AckTracker
+{
+  // up to SLOTS commands awaiting acknowledgement, each from one sender (T, e.g. a widget)
+  // - resend FIRST_MS after the first send if not acknowledged, the wait doubling up to MAX_MS, RETRIES times at most
+  // - a new command from the same sender replaces its own in place; previous (what to go back to if it is never
+  //   acknowledged) stays that of the first
+  // - what counts as an acknowledgement, and sending, are the owner's: acknowledge(), fail(), due()
+  // - times are ms on the owner's clock (millis()); one owner, no locking
+public:
+  struct Command
+  {
+    T *sender;                 // NULL if free
+    int32_t value;             // what is expected back
+    int32_t previous;          // what value replaced
+    uint32_t tag;              // the owner's, e.g. the cache sequence number at the first send
+    unsigned long firstMillis;
+    unsigned long dueMillis;   // resend if not acknowledged by then
+    uint16_t backoffMs;
+    uint8_t retries;
+  };
+
+  enum Due
+  {
+    ACK_WAIT,   // not yet
+    ACK_RESEND, // send it again now; the next resend is due twice as long after
+    ACK_GIVE_UP // RETRIES resends and still nothing: fail() it
+  };
+
+  AckTracker() : failed(0), untracked(0)
+  {
+    for (uint8_t a = 0; a < SLOTS; a++)
+    {
+      commands[a].sender = NULL;
+    }
+    for (uint8_t r = 0; r <= RETRIES; r++)
+    {
+      retried[r] = 0;
+    }
+  };
+
+  // sender has just sent value, replacing previous; false if every slot is busy
+  bool track(T *sender, int32_t value, int32_t previous, uint32_t tag, unsigned long now)
+  {
+    int slot = -1;
+    for (uint8_t a = 0; a < SLOTS; a++)
+    {
+      if (commands[a].sender == sender)
+      {
+        slot = a;
+        break;
+      }
+      if (slot < 0 && !commands[a].sender)
+      {
+        slot = a;
+      }
+    }
+    if (slot < 0)
+    {
+      untracked++;
+      return false;
+    }
+    Command &c = commands[slot];
+    if (c.sender != sender) // if sent again before an acknowledgement, the value to go back to stays
+    {
+      c.previous = previous;
+    }
+    c.sender = sender;
+    c.value = value;
+    c.tag = tag;
+    c.firstMillis = now;
+    c.backoffMs = FIRST_MS;
+    c.dueMillis = now + FIRST_MS;
+    c.retries = 0;
+    return true;
+  };
+
+  // slot a; its sender is NULL if it is free
+  Command &command(uint8_t a) { return commands[a]; };
+
+  // slot a acknowledged at now: counted by the resends it needed, and freed; returns ms since the first send
+  unsigned long acknowledge(uint8_t a, unsigned long now)
+  {
+    retried[commands[a].retries]++;
+    commands[a].sender = NULL;
+    return now - commands[a].firstMillis;
+  };
+
+  // slot a given up, or refused: counted, and freed
+  void fail(uint8_t a)
+  {
+    failed++;
+    commands[a].sender = NULL;
+  };
+
+  // slot a no longer awaited, e.g. a newer command would take its acknowledgement: freed, not counted
+  void forget(uint8_t a)
+  {
+    commands[a].sender = NULL;
+  };
+
+  // slot a, busy and not acknowledged: what to do about it at now
+  Due due(uint8_t a, unsigned long now)
+  {
+    Command &c = commands[a];
+    if ((long)(now - c.dueMillis) < 0)
+    {
+      return ACK_WAIT;
+    }
+    if (c.retries >= RETRIES)
+    {
+      return ACK_GIVE_UP;
+    }
+    c.retries++;
+    c.backoffMs = (c.backoffMs * 2 > MAX_MS) ? MAX_MS : c.backoffMs * 2;
+    c.dueMillis = now + c.backoffMs;
+    return ACK_RESEND;
+  };
+
+  // nothing awaiting acknowledgement
+  bool idle()
+  {
+    for (uint8_t a = 0; a < SLOTS; a++)
+    {
+      if (commands[a].sender)
+      {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  uint32_t retriedCount(uint8_t r) { return retried[r]; }; // acknowledged after r resends
+  uint32_t failedCount() { return failed; };
+  uint32_t untrackedCount() { return untracked; };         // no free slot
+
+private:
+  Command commands[SLOTS];
+  uint32_t retried[RETRIES + 1];
+  uint32_t failed;
+  uint32_t untracked;
+};
+
+#endif
@@ -0,0 +1,82 @@
+// ***************************************************************
+// MpscQueue: bounded lock-free queue between tasks
+// - header only and free of Arduino, so the same code is tested on the PC (pio test -e native)
+// ***************************************************************
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <stdint.h>
+
+template <typename T, uint16_t N>
+class MpscQueue
+{
+  // bounded lock-free queue: any number of producer tasks, one consumer task
+  // - fixed storage, no allocation; each slot carries a sequence number saying whose turn it is
+  // - pop() is constant time; push() retries only if another producer took the same slot first
+  // - N must be a power of 2
+  static_assert(N && (N & (N - 1)) == 0, "MpscQueue size must be a power of 2");
+
+public:
+  MpscQueue() : head(0), tail(0)
+  {
+    for (uint16_t i = 0; i < N; i++)
+    {
+      slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+  };
+
+  // false if full
+  bool push(const T &item)
+  {
+    uint32_t pos = tail.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      Slot &slot = slots[pos & (N - 1)];
+      int32_t diff = (int32_t)(slot.seq.load(std::memory_order_acquire) - pos);
+      if (diff == 0)
+      {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          slot.item = item;
+          slot.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (diff < 0)
+      {
+        return false; // the consumer has not emptied this slot yet
+      }
+      else
+      {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+  };
+
+  // consumer only; false if empty
+  bool pop(T &item)
+  {
+    uint32_t pos = head.load(std::memory_order_relaxed);
+    Slot &slot = slots[pos & (N - 1)];
+    if ((int32_t)(slot.seq.load(std::memory_order_acquire) - (pos + 1)) < 0)
+    {
+      return false;
+    }
+    item = slot.item;
+    slot.seq.store(pos + N, std::memory_order_release);
+    head.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  };
+
+private:
+  struct Slot
+  {
+    std::atomic<uint32_t> seq;
+    T item;
+  } slots[N];
+  std::atomic<uint32_t> head;
+  std::atomic<uint32_t> tail;
+};
+
+#endif
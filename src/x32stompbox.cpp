@@ -7,16 +7,27 @@
 
 // #include <Arduino.h> // this is already called by Button.h, etc
 
+// flags and queues shared between tasks
+#include <atomic>
+#include "MpscQueue.h" // no Arduino in it, so test/ builds it on the PC too
+#include "AckTracker.h" // likewise
+
 // button library https://github.com/madleech/Button
 #include <Button.h>
 
 // wifi library https://www.arduino.cc/en/Reference/WiFi
 #include <WiFi.h>
 #include <WiFiUdp.h>
+#include <lwip/sockets.h>
+#include <lwip/udp.h>
+#include <lwip/priv/tcpip_priv.h> // tcpip_api_call, as AsyncUDP uses
 
 // osc message library https://github.com/CNMAT/OSC
 #include <OSCMessage.h>
 
+// non-volatile storage https://github.com/espressif/arduino-esp32/tree/master/libraries/Preferences
+#include <Preferences.h>
+
 // MIDI support https://github.com/FortySevenEffects/arduino_midi_library
 #include <MIDI.h>
 #include <midi_Defs.h>
@@ -44,221 +55,3395 @@
 // ***************************************************************
 // constructs
 // ***************************************************************
-class OSCWidget
+#define PARAM_CACHE_SIZE 64   // maximum number of distinct OSC addresses we keep; once full, new ones are not cached
+                              // (logged once, counted in the status); the widgets' addresses are interned first
+#define PARAM_ADDRESS_LEN 32  // longest OSC address we keep, including terminator
+#define PARAM_STRING_LEN 16   // longest string value we keep, including terminator
+#define PARAM_HASH_SIZE 128   // must be a power of 2 and larger than PARAM_CACHE_SIZE
+#define PARAM_NONE 0xFF       // "no such parameter"
+
+#define param_WATCHED 0x01    // referenced by a widget
+#define param_CONFIRMED 0x02  // value came from the X32 (not assumed locally)
+#define param_STALE 0x04      // value restored from NVS at boot, or invalidated by a show change; not yet heard from the X32
+#define param_RELAYED 0x08    // relay master: peers want updates for this address
+#define param_PENDING 0x10    // we sent a toggle state the console has not acknowledged yet (see ackPoll)
+
+#define BANK_ALL 0xFF          // widget responds in every bank
+
+typedef uint8_t paramId_t;
+
+struct ParamEntry
 {
-  // depends on Button.h
-  // depends on pinMode, digitalWrite
+  char address[PARAM_ADDRESS_LEN];
+  uint8_t target;              // which console it belongs to (index into consoleTargets)
+  char type;                   // 0 = no value yet, otherwise 'i', 'f' or 's'
+  uint8_t flags;               // param_WATCHED, param_CONFIRMED
+  int32_t i;                   // int value ('i'), or index following a string ('s', e.g. /load,si)
+  float f;                     // float value ('f')
+  char s[PARAM_STRING_LEN];    // string value ('s')
+  uint32_t seq;                // sequence number of the last update
+  unsigned long updatedMillis; // when was it last updated?
+};
+
+class ParamCache
+{
+  // local mirror of the X32 parameters we watch or receive
+  // - each OSC address is interned once; afterwards everything refers to its paramId_t
+  // - updated by taskUDPLoop, read by the button, LED, MIDI and logging code
+  // - entries are copied out under a spinlock so readers never see half an update
 public:
-  char *friendlyDebugName; // e.g. Button 1, Button 2
-  uint8_t buttonPin;       // corresponding GPIO pin
-  uint8_t ledPin;          // corresponding GPIO pin
-  Button button;
-  int actionTrigger;       // action_PRESS or action_LONG_PRESS
-  unsigned long pressedMillis; // when was the button pressed?
-  bool wasPressed;
+  ParamCache() : count(0), lastSeq(0), overflows(0)
+  {
+    memset(hashIndex, 0, sizeof(hashIndex));
+  };
 
-  bool isOscToggle;   // is this a toggle (like Mute) or snippet
-  bool isReverseLed;  // LED state opposite to boolean state
-  char *oscAddress;   // OSC address
-  char *oscPayload_s; // OSC payload - relevent only for snippets
-  int oscState;       // OSC state (for toggle values like Mute)
-  int oscPayload_i;   // for loading snippets
-  float oscPayload_f; // for fader values
+  // find an address on a console, adding it if it is not known yet; PARAM_NONE if full or too long
+  paramId_t intern(const char *address, uint8_t target = 0)
+  {
+    paramId_t id;
+    if (strlen(address) >= PARAM_ADDRESS_LEN)
+    {
+      return PARAM_NONE;
+    }
+    portENTER_CRITICAL(&mux);
+    uint8_t slot = probe(address, target);
+    if (hashIndex[slot])
+    {
+      id = hashIndex[slot] - 1;
+    }
+    else if (count < PARAM_CACHE_SIZE)
+    {
+      id = count++;
+      memset(&entries[id], 0, sizeof(ParamEntry));
+      strcpy(entries[id].address, address);
+      entries[id].target = target;
+      hashIndex[slot] = id + 1;
+    }
+    else
+    {
+      id = PARAM_NONE;
+      overflows++;
+    }
+    uint32_t overflowed = (id == PARAM_NONE) ? overflows : 0;
+    portEXIT_CRITICAL(&mux);
+    if (overflowed == 1)
+    {
+      Serial.print("paramCache full (PARAM_CACHE_SIZE), not cached from now on: ");
+      Serial.println(address);
+    }
+    return id;
+  };
 
-  OSCWidget(char *theFriendlyName,
-            int theButtonPin,
-            int theLedPin,
-            int theTrigger,
-            bool theOscType, 
-            bool theLedResponse,
-            char *theOscAddress,
-            char *theOscPayload_s,
-            int theOscIndex = -1,
-            float theOscPayload_f = -1)
-      : button(theButtonPin),
-        friendlyDebugName(theFriendlyName),
-        buttonPin(theButtonPin),
-        ledPin(theLedPin),
-        actionTrigger(theTrigger),
-        isOscToggle(theOscType),
-        isReverseLed(theLedResponse),
-        oscAddress(theOscAddress),
-        oscPayload_s(theOscPayload_s),// use "" if not used
-        oscPayload_f(theOscPayload_f),// use -1 if not used
-        oscPayload_i(theOscIndex),    // use -1 if not used
-        oscState(0),
-        wasPressed(false)
+  paramId_t find(const char *address, uint8_t target = 0)
   {
-    pinMode(buttonPin, INPUT_PULLUP); // initialise the pin for input
-    pinMode(ledPin, OUTPUT);          // initialise the pin for LED
-    button.begin();
+    portENTER_CRITICAL(&mux);
+    uint8_t slot = probe(address, target);
+    paramId_t id = (hashIndex[slot]) ? hashIndex[slot] - 1 : PARAM_NONE;
+    portEXIT_CRITICAL(&mux);
+    return id;
   };
 
-  void doDigitalWrite(uint8_t val)
+  void setWatched(paramId_t id)
   {
-    digitalWrite(ledPin, val);
+    if (id >= count) return;
+    portENTER_CRITICAL(&mux);
+    entries[id].flags |= param_WATCHED;
+    portEXIT_CRITICAL(&mux);
   };
 
-  void print()
+  void setRelayed(paramId_t id)
   {
-    Serial.print(friendlyDebugName);
-    Serial.print(",\t");
-    Serial.print(buttonPin);
-    Serial.print(",\t");
-    Serial.print(ledPin);
-    Serial.print(",\t");
-    Serial.print(actionTrigger);
-    Serial.print(",\t");    
-    Serial.print(isOscToggle);
-    Serial.print(",\t");
-    Serial.print(isReverseLed);
-    Serial.print(",\t");
-    Serial.print(oscAddress);
-    Serial.print(", ");
-    Serial.print(oscPayload_s);
-    Serial.print(", i ");
-    Serial.print(oscPayload_i);
-    Serial.print(", f ");
-    Serial.print(oscPayload_f);    
-    Serial.print(" (");
-    Serial.print(oscState);
-    Serial.println(")");
+    if (id >= count) return;
+    portENTER_CRITICAL(&mux);
+    entries[id].flags |= param_RELAYED;
+    portEXIT_CRITICAL(&mux);
   };
-};
 
-// MIDI OSC Hex converter
-char bigMidiCommand[64];                            // maximum command length in bytes
-char midiHeader[] = {0xF0, 0x00, 0x20, 0x32, 0x32}; // X32 OSC preamble
-char midiSpacer[] = {0x20};                         // X32 OSC spacer
-char midiFooter[] = {0xF7};                         // X32 OSC post-amble
+  void setPending(paramId_t id, bool pending)
+  {
+    if (id >= count) return;
+    portENTER_CRITICAL(&mux);
+    entries[id].flags = (pending) ? (entries[id].flags | param_PENDING) : (entries[id].flags & ~param_PENDING);
+    portEXIT_CRITICAL(&mux);
+  };
 
-char *stringOFF = "OFF";
-char *stringON = "ON";
+  // value restored from NVS; stays stale until the next update
+  void restoreInt(paramId_t id, int32_t value)
+  {
+    if (id >= count) return;
+    portENTER_CRITICAL(&mux);
+    entries[id].type = 'i';
+    entries[id].i = value;
+    touch(entries[id], false);
+    entries[id].flags |= param_STALE;
+    portEXIT_CRITICAL(&mux);
+  };
 
-#define action_NOTHING 0x00
-#define action_PRESS 0x01
-#define action_LONG_PRESS 0x02
-#define action_VLONG_PRESS 0x04
-#define mask_LONG_PRESS 0x06 // binary 0110
-#define LONG_PRESS_DURATION 1000  // 1 second
-#define VERY_LONG_PRESS_DURATION 3000 // 3 seconds
+  // a confirmed value other than the pending one is ignored, e.g. a periodic /subscribe resend sent before our
+  // command arrived, which would flip the LED back and forth; returns false if ignored
+  bool setInt(paramId_t id, int32_t value, bool confirmed)
+  {
+    if (id >= count) return false;
+    portENTER_CRITICAL(&mux);
+    if (confirmed && (entries[id].flags & param_PENDING) && entries[id].type == 'i' && entries[id].i != value)
+    {
+      portEXIT_CRITICAL(&mux);
+      return false;
+    }
+    entries[id].type = 'i';
+    entries[id].i = value;
+    touch(entries[id], confirmed);
+    portEXIT_CRITICAL(&mux);
+    return true;
+  };
 
-// ***************************************************************
-// site settings, network configuration, etc
-// ***************************************************************
-char const *ssid = MYSSID;
-char const *pass = MYPASS;
+  void setFloat(paramId_t id, float value, bool confirmed)
+  {
+    if (id >= count) return;
+    portENTER_CRITICAL(&mux);
+    entries[id].type = 'f';
+    entries[id].f = value;
+    touch(entries[id], confirmed);
+    portEXIT_CRITICAL(&mux);
+  };
 
-const IPAddress X32Address MYX32ADDRESS;
-const unsigned int X32Port = 10023;  // X-AIR is 10024, X32 is 10023
-const unsigned int localPort = 8888; // local port to listen for OSC packets (also sends UDP from this port)
-#define MY_HOSTNAME "X32_StompBox"
+  void setString(paramId_t id, const char *value, int32_t index, bool confirmed)
+  {
+    if (id >= count) return;
+    portENTER_CRITICAL(&mux);
+    entries[id].type = 's';
+    strncpy(entries[id].s, value, PARAM_STRING_LEN - 1);
+    entries[id].s[PARAM_STRING_LEN - 1] = 0;
+    entries[id].i = index;
+    touch(entries[id], confirmed);
+    portEXIT_CRITICAL(&mux);
+  };
 
-// ***************************************************************
-// payload and button configuration, including pin configuration
-// ***************************************************************
-OSCWidget myWidgets[] = {
-    //         friendly_name      action_trigger                    oscAddress
-    //                    button_pin                  isOscToggle                           payload_s
-    //                        led_pin                        isReverseLed                         [payload_i], [payload_f]
-    OSCWidget("Bttn A__", 12, 13, action_VLONG_PRESS, false, false, "/load",                "snippet", 10),   // 10 = init snippet
-    OSCWidget("Button A", 12, 13, action_PRESS,       false, false, "/load",                "snippet", 13),   // 13 = lectern on
-    OSCWidget("Button B", 14, 15, action_PRESS,       false, false, "/load",                "snippet", 16),   // 16 = lectern louder
-    OSCWidget("Button C", 27,  2, action_PRESS,       false, false, "/load",                "snippet", 12),   // 12 = band speak
-    OSCWidget("Bttn C__", 27,  2, action_LONG_PRESS,  false, false, "/load",                "snippet", 15),   // 15 = band speak louder
-    OSCWidget("Button D", 26,  0, action_PRESS,       false, false, "/load",                "snippet", 11),   // 11 = band sing
-    OSCWidget("Button E", 25,  4, action_PRESS,       true,  true , "/dca/5/on",            ""),              // DCA 5 = speech
-    OSCWidget("Button F", 33,  5, action_PRESS,       true,  false, "/config/mute/6",       "")};             // Mute Group 6 = all band
+  // copy out a consistent snapshot; false if unknown id
+  bool get(paramId_t id, ParamEntry &out)
+  {
+    if (id >= count) return false;
+    portENTER_CRITICAL(&mux);
+    out = entries[id];
+    portEXIT_CRITICAL(&mux);
+    return true;
+  };
 
-//    OSCWidget("Button G", 32, 18, action_NOTHING,     true,  false, "/config/mute/6",       ""),              // Mute Group 6 = all band
-//    OSCWidget("Button H", 35, 23, action_NOTHING,     true,  true , "/dca/5/on",            "")};             // DCA 5 = speech
+  // int value if we have one, otherwise the default
+  int32_t getInt(paramId_t id, int32_t defaultValue = 0)
+  {
+    int32_t value = defaultValue;
+    if (id >= count) return value;
+    portENTER_CRITICAL(&mux);
+    if (entries[id].type == 'i')
+    {
+      value = entries[id].i;
+    }
+    portEXIT_CRITICAL(&mux);
+    return value;
+  };
 
-//    OSCWidget("Example", 35, 23, action_PRESS,       true,  true , "/ch/01/mix/on",        ""),
-//    OSCWidget("Example", 35, 23, action_NOTHING,     true,  true , "/dca/5/on",            ""),
-//    OSCWidget("Example", 35, 23, action_NOTHING,     true,  false, "/config/mute/1",       ""),
-//    OSCWidget("Example", 35, 23, action_LONG_PRESS,  false, false, "/load",                "snippet", 99),
-//    OSCWidget("Example", 35, 23, action_NOTHING,     false, false, "/ch/02/mix/09/level",  "", -1 , 0.75),
+  // has the X32 told us the value (as opposed to nothing known, or assumed locally)?
+  bool isConfirmed(paramId_t id)
+  {
+    if (id >= count) return false;
+    portENTER_CRITICAL(&mux);
+    bool confirmed = entries[id].type && (entries[id].flags & param_CONFIRMED);
+    portEXIT_CRITICAL(&mux);
+    return confirmed;
+  };
 
-// LOLIN32 Lite
-// GPIO INPUTS 34,35,36,39 do not have internal pull-up/pull-down therefore do not define in myWidgets unless actually needed
-// GPIO 2 is pulled down at start so LED will initially look dimly lit
-#define MIDI_UART 2 // GPIO 16,17
-// UNUSED_GPIO 39                       // unused GPIO pin
-#define PIN_FOR_WIFI_STATUS_LED 22         // internal LED is 22 for my LOLIN32
-#define PIN_FOR_MODE_SWITCH 36             // needs pull-up
-#define PIN_FOR_BATTERY_VOLTAGE 34         // cannot use ADC2 pins (needed for WiFi)
-#define PIN_FOR_BATTERY_STATUS_LED 19      //
-#define BATTERY_LOW_CUTOFF 3034            // 3034 is 20% between 3.10V and 4.16V using divider 68k/(68k+27k)
-#define BATTERY_FULL_CUTOFF 3762           // 3713 = 90%, 3762 = 95%, 3801 = 99%; it only periodically hits 95%
-#define BATTERY_MIN 2840                   // 2840 corresponds to 3.10V in calculations using the above divider
-#define BATTERY_RANGE (3811 - BATTERY_MIN) // 3811 corresponds to 4.16V
-#define ADC_VMAX 3.2                       // apparently 3.2V gives 4095
-#define ADC_DIVIDER 0.715789474            // (68 / (68+27))
+  // forget that the console confirmed any of its entries whose address starts with one of the prefixes
+  // (values are kept, and shown as stale); returns one bit per paramId invalidated
+  uint64_t invalidate(uint8_t target, const char *const *prefixes, int numberOfPrefixes)
+  {
+    uint64_t invalidated = 0;
+    portENTER_CRITICAL(&mux);
+    for (paramId_t id = 0; id < count; id++)
+    {
+      if (entries[id].target != target)
+      {
+        continue;
+      }
+      for (int p = 0; p < numberOfPrefixes; p++)
+      {
+        if (strncmp(entries[id].address, prefixes[p], strlen(prefixes[p])) == 0)
+        {
+          if (entries[id].flags & param_CONFIRMED)
+          {
+            entries[id].flags = (entries[id].flags & ~param_CONFIRMED) | param_STALE;
+            invalidated |= (1ULL << id);
+          }
+          break;
+        }
+      }
+    }
+    portEXIT_CRITICAL(&mux);
+    return invalidated;
+  };
 
-// BATTERY THRESHOLDS 0 (0V) - 4095 (3.3V); value depends on voltage divider circuit
-// however apparently 3.2V gives 4095 therefore adjusted table below
-// ---------------- ----- === 0.50 ====   === 0.67 ====   === 0.75 ====
-// battery depleted 3.10V (1.55V, 1984)   (2.08V, 2658)   (2.33V, 2975)
-// battery low 20%  3.31V (1.66V, 2119)   (2.22V, 2840)   (2.48V, 3179)
-// battery full     4.16V (2.08V, 2662)   (2.79V, 3567)   (3.12V, 3993)
-// battery charging 4.26V (2.13V, 2726)   (2.85V, 3652)   (3.20V, 4089)
+  bool isStale(paramId_t id)
+  {
+    if (id >= count) return false;
+    portENTER_CRITICAL(&mux);
+    bool stale = entries[id].flags & param_STALE;
+    portEXIT_CRITICAL(&mux);
+    return stale;
+  };
 
-#if true
-// LED lights up if pin pulls voltage down (sink)
-#define LED_PIN_ON LOW
-#define LED_PIN_OFF HIGH
-#else
-// LED is powered from pin (source)
-#define LED_PIN_ON HIGH
-#define LED_PIN_OFF LOW
-#endif
+  uint8_t size() { return count; };
 
-// ******************************************************
-// other variables
-// ******************************************************
-Button modeButton(PIN_FOR_MODE_SWITCH);
-bool do_xRemote = true;
-bool do_Refresh = true;
-WiFiUDP Udp;
-HardwareSerial SerialMIDI(MIDI_UART);
-MIDI_CREATE_INSTANCE(HardwareSerial, SerialMIDI, midiOut); // create a MIDI object called midiOut
-TaskHandle_t xUDPLoopHandle = NULL;
-TaskHandle_t xPokeOSCLoopHandle = NULL;
+  // addresses not cached because the table was full
+  uint32_t overflowCount() { return overflows; };
 
-// ***************************************************************
-// ***************************************************************
-// ***************************************************************
+  // sequence number of the most recent update to any entry
+  uint32_t sequence()
+  {
+    portENTER_CRITICAL(&mux);
+    uint32_t seq = lastSeq;
+    portEXIT_CRITICAL(&mux);
+    return seq;
+  };
 
-// ***************************************************************
-// various minor helper functions
-// ***************************************************************
+  // FNV-1a; also used to identify addresses in NVS
+  // (target 0 hashes as it did before there were several consoles, so saved states still match)
+  static uint32_t hash(const char *address, uint8_t target = 0)
+  {
+    uint32_t h = 2166136261u;
+    if (target)
+    {
+      h = (h ^ target) * 16777619u;
+    }
+    for (const char *p = address; *p; p++)
+    {
+      h = (h ^ (uint8_t)*p) * 16777619u;
+    }
+    return h;
+  };
 
-void printMillis()
+  void print()
+  {
+    ParamEntry e;
+    for (paramId_t id = 0; id < count; id++)
+    {
+      get(id, e);
+      Serial.print(id);
+      Serial.print(",\t");
+      Serial.print(e.target);
+      Serial.print(":");
+      Serial.print(e.address);
+      Serial.print(",\t");
+      switch (e.type)
+      {
+      case 'i':
+        Serial.print("i ");
+        Serial.print(e.i);
+        break;
+      case 'f':
+        Serial.print("f ");
+        Serial.print(e.f);
+        break;
+      case 's':
+        Serial.print("s ");
+        Serial.print(e.s);
+        Serial.print(" ");
+        Serial.print(e.i);
+        break;
+      default:
+        Serial.print("-");
+      }
+      Serial.print(" (seq ");
+      Serial.print(e.seq);
+      Serial.print(", ");
+      Serial.print(e.updatedMillis);
+      Serial.println((e.flags & param_CONFIRMED) ? ")" : ", assumed)");
+    }
+  };
+
+private:
+  ParamEntry entries[PARAM_CACHE_SIZE];
+  uint8_t hashIndex[PARAM_HASH_SIZE]; // id + 1, or 0 if empty
+  uint8_t count;
+  uint32_t lastSeq;
+  uint32_t overflows;
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+  void touch(ParamEntry &e, bool confirmed)
+  {
+    e.seq = ++lastSeq;
+    e.updatedMillis = millis();
+    e.flags = (confirmed) ? (e.flags | param_CONFIRMED) : (e.flags & ~param_CONFIRMED);
+    e.flags &= ~param_STALE;
+  };
+
+  // hash, then linear probe to the slot holding this address or the first empty slot
+  // (caller must hold mux)
+  uint8_t probe(const char *address, uint8_t target)
+  {
+    uint8_t slot = hash(address, target) & (PARAM_HASH_SIZE - 1);
+    while (hashIndex[slot] && (entries[hashIndex[slot] - 1].target != target || strcmp(entries[hashIndex[slot] - 1].address, address) != 0))
+    {
+      slot = (slot + 1) & (PARAM_HASH_SIZE - 1);
+    }
+    return slot;
+  };
+};
+
+#define NVS_NAMESPACE "x32stompbox"
+#define NVS_KEY "state"
+#define NVS_DEBOUNCE_MS 2000       // wait for changes to settle before writing
+#define NVS_MIN_INTERVAL_MS 30000  // never write more often than this (flash wear)
+
+struct NvsRecord
 {
-  Serial.print("[");
-  Serial.print(millis());
-  Serial.print("] ");
-}
+  uint32_t addressHash; // ParamCache::hash of the OSC address and console
+  int32_t value;
+};
 
-// ***************************************************************
-// void midiBuildCommand
-// - construct a MIDI SysEx from the OSC command
-// ***************************************************************
-void midiBuildCommand(char* oscCommand, char* oscArgument)
+void printMillis(); // see helper functions below
+void sendOSC(uint8_t target, OSCMessage &msg, uint8_t txClass);
+void coalescedSend(paramId_t id, float value, unsigned long pressMicros);
+void ledWrite(uint8_t pin, uint8_t level);
+
+class NvsStateStore
 {
-  // update global variable: bigMidiCommand
-  // no error checking to ensure that bigMidiCommand does not exceed 64 char
-  bigMidiCommand[0] = 0;
-  strcat(bigMidiCommand,midiHeader);
-  strcat(bigMidiCommand,oscCommand);
-  strcat(bigMidiCommand,midiSpacer);
-  strcat(bigMidiCommand,oscArgument);
-  strcat(bigMidiCommand,midiFooter);
+  // last known X32 toggle states, kept in NVS so the LEDs are right straight after power-up
+  // - writes are coalesced: debounced, batched into one blob, rate limited and skipped if unchanged
+  // - the debounce watches the states we keep, not the cache as a whole: renewals and probe replies touch it all the time
+  // - depends on Preferences.h
+public:
+  NvsStateStore(ParamCache &theCache)
+      : cache(theCache),
+        recordCount(0),
+        seenDigest(0),
+        changedMillis(0),
+        writeMillis(0),
+        writes(0),
+        pending(false) {};
 
-  // DEBUG print the HEX string generated
-#ifdef VERBOSE_DEBUG
-  Serial.print("MIDI Message in HEX: ");
-  for (int j = 0; j < strlen(bigMidiCommand); j++)
+  // load the blob and put what we recognise into the cache as stale; returns number restored
+  int restore()
+  {
+    int restored = 0;
+    ParamEntry e;
+    preferences.begin(NVS_NAMESPACE, true);
+    size_t len = preferences.getBytes(NVS_KEY, records, sizeof(records));
+    preferences.end();
+    recordCount = len / sizeof(NvsRecord);
+    for (paramId_t id = 0; id < cache.size(); id++)
+    {
+      cache.get(id, e);
+      if (!(e.flags & param_WATCHED)) continue;
+      uint32_t h = ParamCache::hash(e.address, e.target);
+      for (int r = 0; r < recordCount; r++)
+      {
+        if (records[r].addressHash == h)
+        {
+          cache.restoreInt(id, records[r].value);
+          restored++;
+          break;
+        }
+      }
+    }
+    NvsRecord fresh[PARAM_CACHE_SIZE];
+    seenDigest = digest(fresh, collect(fresh));
+    return restored;
+  };
+
+  // call periodically; writes to NVS at most once per NVS_MIN_INTERVAL_MS, and only if mayWrite (a due write
+  // waits for a call that allows it)
+  void tick(bool mayWrite = true)
+  {
+    unsigned long now = millis();
+    NvsRecord fresh[PARAM_CACHE_SIZE];
+    int freshCount = collect(fresh);
+    uint32_t d = digest(fresh, freshCount);
+    if (d != seenDigest)
+    {
+      seenDigest = d;
+      changedMillis = now;
+      pending = true;
+    }
+    if (!pending || !mayWrite || (now - changedMillis) < NVS_DEBOUNCE_MS || (writes && (now - writeMillis) < NVS_MIN_INTERVAL_MS))
+    {
+      return;
+    }
+    pending = false;
+
+    if (freshCount == 0 || (freshCount == recordCount && memcmp(fresh, records, freshCount * sizeof(NvsRecord)) == 0))
+    {
+      return; // nothing new to say
+    }
+    memcpy(records, fresh, freshCount * sizeof(NvsRecord));
+    recordCount = freshCount;
+    preferences.begin(NVS_NAMESPACE, false);
+    preferences.putBytes(NVS_KEY, records, recordCount * sizeof(NvsRecord));
+    preferences.end();
+    writeMillis = now;
+    writes++;
+    printMillis();
+    Serial.print("NVS: saved ");
+    Serial.print(recordCount);
+    Serial.print(" states, write #");
+    Serial.println(writes);
+  };
+
+private:
+  ParamCache &cache;
+  Preferences preferences;
+  NvsRecord records[PARAM_CACHE_SIZE]; // as last read from or written to NVS
+  int recordCount;
+  uint32_t seenDigest;                 // of the states as last collected
+
+  // only confirmed toggle states are worth remembering; returns how many
+  int collect(NvsRecord *fresh)
+  {
+    int freshCount = 0;
+    ParamEntry e;
+    for (paramId_t id = 0; id < cache.size(); id++)
+    {
+      cache.get(id, e);
+      if ((e.flags & param_WATCHED) && (e.flags & param_CONFIRMED) && e.type == 'i')
+      {
+        fresh[freshCount].addressHash = ParamCache::hash(e.address, e.target);
+        fresh[freshCount].value = e.i;
+        freshCount++;
+      }
+    }
+    return freshCount;
+  };
+
+  static uint32_t digest(const NvsRecord *fresh, int freshCount)
+  {
+    uint32_t h = 2166136261u;
+    const uint8_t *p = (const uint8_t *)fresh;
+    for (size_t i = 0; i < freshCount * sizeof(NvsRecord); i++)
+    {
+      h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+  };
+  unsigned long changedMillis;
+  unsigned long writeMillis;
+  uint32_t writes;
+  bool pending;
+};
+
+#define REFRESH_WINDOW 4          // queries outstanding at once
+#define REFRESH_TIMEOUT_MS 150    // resend a query if no reply within this time
+#define REFRESH_RETRIES 3         // give up on a query after this many resends
+
+class RefreshEngine
+{
+  // paced bulk refresh of parameters from the X32
+  // - at most REFRESH_WINDOW queries are outstanding; replies are matched by paramId
+  // - queries without a reply are resent after REFRESH_TIMEOUT_MS, up to REFRESH_RETRIES times
+  // - request() and onReply() may be called from any task; tick() from the task that sends
+public:
+  RefreshEngine()
+      : pendingMask(0),
+        urgentMask(0),
+        startMillis(0),
+        queried(0),
+        retries(0),
+        lost(0),
+        running(false)
+  {
+    for (auto &slot : inFlight)
+    {
+      slot.id = PARAM_NONE;
+    }
+  };
+
+  // ask for this parameter to be (re)fetched; urgent ones are queried first
+  void request(paramId_t id, bool urgent = false)
+  {
+    if (id >= PARAM_CACHE_SIZE) return;
+    portENTER_CRITICAL(&mux);
+    if (!running)
+    {
+      running = true;
+      startMillis = millis();
+      queried = retries = lost = 0;
+    }
+    pendingMask |= (1ULL << id);
+    if (urgent)
+    {
+      urgentMask |= (1ULL << id);
+    }
+    portEXIT_CRITICAL(&mux);
+  };
+
+  // a reply for this parameter has arrived
+  void onReply(paramId_t id)
+  {
+    if (id >= PARAM_CACHE_SIZE) return;
+    portENTER_CRITICAL(&mux);
+    for (auto &slot : inFlight)
+    {
+      if (slot.id == id)
+      {
+        slot.id = PARAM_NONE;
+      }
+    }
+    pendingMask &= ~(1ULL << id); // no need to ask any more
+    urgentMask &= ~(1ULL << id);
+    portEXIT_CRITICAL(&mux);
+  };
+
+  // returns the number of ids placed in toSend (at most REFRESH_WINDOW) which the caller must query now
+  int tick(paramId_t *toSend)
+  {
+    int n = 0;
+    unsigned long now = millis();
+    portENTER_CRITICAL(&mux);
+    for (auto &slot : inFlight)
+    {
+      if (slot.id != PARAM_NONE && (now - slot.sentMillis) > REFRESH_TIMEOUT_MS)
+      {
+        if (slot.tries > REFRESH_RETRIES)
+        {
+          slot.id = PARAM_NONE; // give up
+          lost++;
+        }
+        else
+        {
+          slot.tries++;
+          slot.sentMillis = now;
+          toSend[n++] = slot.id;
+          retries++;
+        }
+      }
+      if (slot.id == PARAM_NONE && pendingMask)
+      {
+        slot.id = __builtin_ctzll((urgentMask) ? urgentMask : pendingMask);
+        pendingMask &= ~(1ULL << slot.id);
+        urgentMask &= ~(1ULL << slot.id);
+        slot.tries = 1;
+        slot.sentMillis = now;
+        toSend[n++] = slot.id;
+        queried++;
+      }
+    }
+    bool done = running && !pendingMask && idle();
+    if (done)
+    {
+      running = false;
+    }
+    portEXIT_CRITICAL(&mux);
+
+    if (done)
+    {
+      printMillis();
+      Serial.print("refresh: ");
+      Serial.print(queried);
+      Serial.print(" queried in ");
+      Serial.print(millis() - startMillis);
+      Serial.print(" ms, ");
+      Serial.print(retries);
+      Serial.print(" retries, ");
+      Serial.print(lost);
+      Serial.println(" lost");
+    }
+    return n;
+  };
+
+  bool isRunning() { return running; };
+
+private:
+  struct
+  {
+    paramId_t id;      // PARAM_NONE if free
+    uint8_t tries;
+    unsigned long sentMillis;
+  } inFlight[REFRESH_WINDOW];
+  uint64_t pendingMask;  // one bit per paramId waiting to be queried
+  uint64_t urgentMask;   // subset of pendingMask to query first
+  unsigned long startMillis;
+  uint16_t queried;
+  uint16_t retries;
+  uint16_t lost;
+  bool running;
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+  // caller must hold mux
+  bool idle()
+  {
+    for (auto &slot : inFlight)
+    {
+      if (slot.id != PARAM_NONE) return false;
+    }
+    return true;
+  };
+};
+static_assert(PARAM_CACHE_SIZE <= 64, "RefreshEngine keeps one bit per paramId in a uint64_t");
+
+#define SUBSCRIBE_XREMOTE 0       // /xremote: every change on the X32 is pushed to us
+#define SUBSCRIBE_PER_ADDRESS 1   // /subscribe: one subscription per watched address
+#define SUBSCRIBE_FORMAT 2        // /formatsubscribe: one subscription for all watched addresses, replies as one blob
+#define SUBSCRIBE_MODE SUBSCRIBE_PER_ADDRESS
+#define SUBSCRIPTION_MAX 16             // watched addresses we can subscribe to
+#define SUBSCRIPTION_LIFETIME_MS 10000  // X32 forgets subscriptions (and /xremote) after 10 seconds
+#define SUBSCRIPTION_RENEW_MS 9000      // renew this long after (re)subscribing, on a clean link
+#define SUBSCRIPTION_RENEW_MIN_MS 3000  // renew this often when the link is very lossy
+#define SUBSCRIPTION_JITTER_MS 250      // +/- random spread on renewals
+#define SUBSCRIPTION_SILENCE_MS 2000    // subscribe again if a subscribed value stops arriving for this long while the X32 is alive
+#define SUBSCRIPTION_TIME_FACTOR 20     // X32 resends subscribed values every time factor x 50 ms
+static_assert(SUBSCRIPTION_SILENCE_MS > SUBSCRIPTION_TIME_FACTOR * 50, "a subscription is only silent if it misses a resend");
+#define SUBSCRIPTION_FALLBACK_MS 3000   // fall back to /xremote if subscribed values do not arrive within this time
+#define FORMAT_SUBSCRIPTION_NAME "/stompbox"
+
+// outbound priority classes, highest first; the transport always sends the highest class waiting
+#define TX_CLASS_USER 0         // button presses and what follows them; never held back by the rate limit
+#define TX_CLASS_RENEWAL 1      // subscriptions and their renewals, without which the console stops talking to us
+#define TX_CLASS_REFRESH 2      // refresh queries and relay updates
+#define TX_CLASS_TELEMETRY 3    // liveness probes
+#define TX_CLASSES 4
+#define TX_IDEMPOTENT 0x80      // or'ed into a class: the packet may be sent more than once (TX_COPIES), e.g. absolute sets and queries
+
+typedef void (*OscSender)(uint8_t target, OSCMessage &msg, uint8_t txClass);
+
+#define LIVE_UNKNOWN 0          // not heard from the X32 yet
+#define LIVE_ALIVE 1
+#define LIVE_SUSPECT 2          // a probe was lost
+#define LIVE_DEAD 3             // the probe and its retries were all lost
+#define PROBE_IDLE_MS 500       // probe the X32 after this long without hearing from it
+#define PROBE_TIMEOUT_MS 180    // a probe not answered within this time is lost
+#define PROBE_RETRIES 1         // dead if the probe and its retries are all lost
+#define PROBE_JITTER_MS 40      // +/- random spread on each probe's timeout
+#define PROBE_TICK_MS 10        // tick() runs this often (pokePoll), so it notices each step up to this late
+#define LIVE_DETECT_MS 1000     // worst case from the last traffic to DEAD
+static_assert(PROBE_IDLE_MS + PROBE_TICK_MS + (PROBE_RETRIES + 1) * (PROBE_TIMEOUT_MS + PROBE_JITTER_MS + PROBE_TICK_MS) <= LIVE_DETECT_MS,
+              "the X32 going away would not be noticed within LIVE_DETECT_MS");
+#define RTT_BUCKETS 9           // < 1, 2, 4, ... 128 ms, and the rest
+
+class ConsoleLiveness
+{
+  // is the X32 still there, and how long does it take to answer?
+  // - probes with /info, but only when nothing else has been heard for PROBE_IDLE_MS
+  // - round trip time of every answered probe goes into a histogram of power of 2 ms buckets
+  // - call tick() often from one task; onTraffic() and onProbeReply() from the receiving task
+public:
+  ConsoleLiveness(OscSender theSender)
+      : send(theSender),
+        target(0),
+        name("X32"),
+        liveState(LIVE_UNKNOWN),
+        lastHeardMillis(0),
+        probeReplyMicros(0),
+        probeMicros(0),
+        probeMillis(0),
+        probeTimeoutMs(PROBE_TIMEOUT_MS),
+        probeTries(0),
+        lossPercent(0),
+        probes(0),
+        lost(0)
+  {
+    memset(rttHistogram, 0, sizeof(rttHistogram));
+  };
+
+  // which console we are probing
+  void begin(uint8_t theTarget, const char *theName)
+  {
+    target = theTarget;
+    name = theName;
+  };
+
+  // returns the new state if it changed, otherwise LIVE_UNKNOWN
+  uint8_t tick()
+  {
+    unsigned long now = millis();
+    unsigned long heardMillis = lastHeardMillis;
+    uint8_t oldState = liveState;
+
+    if (probeTries && (long)(heardMillis - probeMillis) >= 0)
+    {
+      // answered; by the probe reply itself if we can time it, otherwise by other traffic
+      unsigned long replyMicros = probeReplyMicros;
+      if ((long)(replyMicros - probeMicros) >= 0)
+      {
+        rttSample(replyMicros - probeMicros);
+      }
+      probeTries = 0;
+      lossSample(false);
+    }
+    else if (probeTries && (now - probeMillis) > probeTimeoutMs)
+    {
+      lost++;
+      lossSample(true);
+      if (probeTries > PROBE_RETRIES || liveState == LIVE_DEAD)
+      {
+        probeTries = 0;
+        liveState = LIVE_DEAD;
+      }
+      else
+      {
+        liveState = LIVE_SUSPECT;
+        probe();
+      }
+    }
+    else if (!probeTries && (now - heardMillis) > PROBE_IDLE_MS && (now - probeMillis) > PROBE_IDLE_MS)
+    {
+      probe(); // suppressed while there is other traffic
+    }
+
+    if ((now - heardMillis) <= PROBE_IDLE_MS && heardMillis)
+    {
+      liveState = LIVE_ALIVE;
+    }
+    if (liveState != oldState)
+    {
+      printMillis();
+      Serial.print(name);
+      Serial.print(" is ");
+      Serial.println(stateName(liveState));
+      return liveState;
+    }
+    return LIVE_UNKNOWN;
+  };
+
+  // forget everything (one-way mode, or no WiFi)
+  void reset()
+  {
+    liveState = LIVE_UNKNOWN;
+    probeTries = 0;
+  };
+
+  // something arrived from the X32 (apart from probe replies)
+  void onTraffic()
+  {
+    lastHeardMillis = millis();
+  };
+
+  // /info reply
+  void onProbeReply()
+  {
+    probeReplyMicros = micros();
+    lastHeardMillis = millis();
+  };
+
+  uint8_t state() { return liveState; };
+  uint8_t lossEstimate() { return lossPercent; };
+
+  static const char *stateName(uint8_t theState)
+  {
+    switch (theState)
+    {
+    case LIVE_ALIVE:
+      return "ALIVE";
+    case LIVE_SUSPECT:
+      return "SUSPECT";
+    case LIVE_DEAD:
+      return "DEAD";
+    default:
+      return "UNKNOWN";
+    }
+  };
+
+  void print()
+  {
+    Serial.print(name);
+    Serial.print(" ");
+    Serial.print(stateName(liveState));
+    Serial.print(", probes ");
+    Serial.print(probes);
+    Serial.print(", lost ");
+    Serial.print(lost);
+    Serial.print(", loss estimate ");
+    Serial.print(lossPercent);
+    Serial.print("%, RTT ms");
+    for (int b = 0; b < RTT_BUCKETS; b++)
+    {
+      Serial.print((b < RTT_BUCKETS - 1) ? " <" : " >=");
+      Serial.print((b < RTT_BUCKETS - 1) ? (1 << b) : (1 << (b - 1)));
+      Serial.print(":");
+      Serial.print(rttHistogram[b]);
+    }
+    Serial.println();
+  };
+
+private:
+  OscSender send;
+  uint8_t target;
+  const char *name;
+  uint8_t liveState;
+  volatile unsigned long lastHeardMillis;
+  volatile unsigned long probeReplyMicros;
+  unsigned long probeMicros;
+  unsigned long probeMillis;
+  unsigned long probeTimeoutMs; // drawn once per probe
+  uint8_t probeTries;        // probes sent without an answer
+  uint8_t lossPercent;       // moving average of probe loss
+  uint32_t probes;
+  uint32_t lost;
+  uint32_t rttHistogram[RTT_BUCKETS];
+
+  void probe()
+  {
+    OSCMessage msg("/info");
+    probeMicros = micros();
+    probeMillis = millis();
+    probeTimeoutMs = PROBE_TIMEOUT_MS + jitter();
+    send(target, msg, TX_CLASS_TELEMETRY);
+    probeTries++;
+    probes++;
+  };
+
+  void rttSample(unsigned long rttMicros)
+  {
+    int b = 0;
+    unsigned long ms = rttMicros / 1000;
+    while (b < RTT_BUCKETS - 1 && ms >= (1UL << b))
+    {
+      b++;
+    }
+    rttHistogram[b]++;
+  };
+
+  void lossSample(bool isLost)
+  {
+    lossPercent = (lossPercent * 7 + ((isLost) ? 100 : 0)) / 8;
+  };
+
+  long jitter()
+  {
+    return (long)(esp_random() % (2 * PROBE_JITTER_MS + 1)) - PROBE_JITTER_MS;
+  };
+};
+
+class SubscriptionManager
+{
+  // keeps the X32 sending us updates for exactly the addresses we watch
+  // - /subscribe or /formatsubscribe, each subscription renewed before its own deadline
+  // - falls back to /xremote if the X32 (or X-Air, or emulator) does not answer subscriptions
+  // - renews earlier as the probe loss estimate goes up
+  // - the X32 resends every subscribed value once per SUBSCRIPTION_TIME_FACTOR, so a subscription that goes quiet
+  //   for SUBSCRIPTION_SILENCE_MS while the X32 is alive has expired (a renewal was lost): /renew cannot bring it
+  //   back, so it is subscribed again (per address, or the whole /formatsubscribe), backing off while it stays quiet
+  // - when ConsoleLiveness declares the X32 dead the subscription has expired; we subscribe
+  //   again as soon as it is back
+  // - time to recover is logged for both: from the silence (or the last traffic before the outage) to the first
+  //   subscribed update after subscribing again
+  // - call tick() often from one task; onTraffic(), onReceive() and onFormatReply() from the receiving task
+  // - only tick()'s task (or setup, before the tasks start) changes the watch list; see relayWatches
+public:
+  SubscriptionManager(ParamCache &theCache, ConsoleLiveness &theLiveness, OscSender theSender)
+      : cache(theCache),
+        liveness(theLiveness),
+        send(theSender),
+        target(0),
+        name("X32"),
+        count(0),
+        mode(SUBSCRIBE_MODE),
+        active(false),
+        heard(false),
+        startMillis(0),
+        renewMillis(0),
+        lastHeardMillis(0),
+        expired(false),
+        resubscribe(false),
+        recovering(false),
+        outageMillis(0),
+        recoveries(0),
+        recoverSumMillis(0) {};
+
+  // which console we are subscribing with
+  void begin(uint8_t theTarget, const char *theName)
+  {
+    target = theTarget;
+    name = theName;
+  };
+
+  // subscribe to this parameter; type is 'i' or 'f', as /formatsubscribe replies are untyped
+  // - setup or tick()'s task only
+  void watch(paramId_t id, char type)
+  {
+    for (int s = 0; s < count; s++)
+    {
+      if (subscriptions[s].id == id) return;
+    }
+    if (id == PARAM_NONE || count >= SUBSCRIPTION_MAX) return;
+    subscriptions[count].id = id;
+    subscriptions[count].type = type;
+    subscriptions[count].deadline = 0;
+    subscriptions[count].heardMillis = 0;
+    subscriptions[count].subscribedMillis = 0;
+    subscriptions[count].silentMillis = 0;
+    subscriptions[count].silentTries = 0;
+    std::atomic_thread_fence(std::memory_order_release); // the receiving task sees the entry before the count
+    count = count + 1;
+    resubscribe = active; // the X32 needs to hear about it
+  };
+
+  // call often while two-way; (re)subscribes and renews as required
+  // returns true if the subscription had expired and was renewed, so everything needs a resync
+  bool tick()
+  {
+    unsigned long now = millis();
+    unsigned long heardMillis = lastHeardMillis;
+    if (!active)
+    {
+      active = true;
+      heard = false;
+      startMillis = now;
+      subscribe(true);
+      return false;
+    }
+    if (mode != SUBSCRIBE_XREMOTE && !heard && (now - startMillis) > SUBSCRIPTION_FALLBACK_MS)
+    {
+      printMillis();
+      Serial.print(name);
+      Serial.println(": subscriptions not answered, falling back to /xremote");
+      mode = SUBSCRIBE_XREMOTE;
+      startMillis = now;
+      subscribe(true);
+      return false;
+    }
+    if (resubscribe)
+    {
+      resubscribe = false;
+      subscribe(true);
+      return false;
+    }
+
+    if (recovering && (long)(heardMillis - startMillis) >= 0)
+    {
+      // first traffic since we subscribed again
+      recovering = false;
+      recovered(heardMillis - outageMillis, "X32 outage");
+    }
+
+    if (liveness.state() == LIVE_DEAD)
+    {
+      if (!expired)
+      {
+        expired = true;
+        outageMillis = heardMillis;
+        printMillis();
+        Serial.print(name);
+        Serial.print(": subscription expired (silent for ");
+        Serial.print(now - heardMillis);
+        Serial.println(" ms)");
+      }
+      return false; // nobody to renew with
+    }
+    if (expired)
+    {
+      // the X32 is back; it has forgotten us, and we have probably missed changes
+      expired = false;
+      recovering = true;
+      printMillis();
+      Serial.print(name);
+      Serial.println(" is back, subscribing again");
+      startMillis = now;
+      forgetSilence(); // timed as an outage instead
+      subscribe(true);
+      return true;
+    }
+
+    // not with /xremote: it only pushes changes, so a quiet console is just quiet
+    bool resync = (mode != SUBSCRIBE_XREMOTE && heard) ? resubscribeSilent(now) : false;
+    subscribe(false);
+    return resync;
+  };
+
+  // something (anything) arrived from the X32
+  void onTraffic()
+  {
+    lastHeardMillis = millis();
+  };
+
+  // forget our subscriptions (one-way mode, or no WiFi); the X32 lets them expire
+  void stop()
+  {
+    active = false;
+    expired = false;
+    recovering = false;
+    forgetSilence();
+    mode = SUBSCRIBE_MODE;
+  };
+
+  // something arrived for this parameter
+  void onReceive(paramId_t id)
+  {
+    if (id == PARAM_NONE || mode == SUBSCRIBE_XREMOTE)
+    {
+      return;
+    }
+    int n = watched();
+    for (int s = 0; s < n; s++)
+    {
+      if (subscriptions[s].id == id)
+      {
+        subscriptions[s].heardMillis = millis();
+        heard = true;
+      }
+    }
+  };
+
+  // decode a /formatsubscribe reply into the cache; returns the number of ids placed in updated, or -1 if not ours
+  int onFormatReply(OSCMessage &msg, paramId_t *updated)
+  {
+    uint8_t blob[4 * (SUBSCRIPTION_MAX + 1)];
+    if (!msg.fullMatch(FORMAT_SUBSCRIPTION_NAME) || !msg.isBlob(0))
+    {
+      return -1;
+    }
+    int len = msg.getBlob(0, blob, sizeof(blob));
+    // values are 4-byte little-endian, possibly preceded by a 4-byte length
+    int watching = watched();
+    int offset = (len == 4 * (watching + 1)) ? 4 : 0;
+    int n = 0;
+    unsigned long now = millis();
+    for (int s = 0; s < watching && offset + 4 <= len; s++, offset += 4)
+    {
+      subscriptions[s].heardMillis = now;
+      if (subscriptions[s].type == 'f')
+      {
+        float f;
+        memcpy(&f, blob + offset, 4);
+        cache.setFloat(subscriptions[s].id, f, true);
+      }
+      else
+      {
+        int32_t i;
+        memcpy(&i, blob + offset, 4);
+        cache.setInt(subscriptions[s].id, i, true);
+      }
+      updated[n++] = subscriptions[s].id;
+    }
+    heard = true;
+    return n;
+  };
+
+  bool isActive() { return active; };
+  unsigned long activeSinceMillis() { return startMillis; };
+  uint8_t effectiveMode() { return mode; };
+  int size() { return count; };
+
+private:
+  ParamCache &cache;
+  ConsoleLiveness &liveness;
+  OscSender send;
+  uint8_t target;
+  const char *name;
+  struct
+  {
+    paramId_t id;
+    char type;
+    unsigned long deadline;             // renew by this time
+    volatile unsigned long heardMillis; // last update for it (the receiving task writes it)
+    unsigned long subscribedMillis;     // last /subscribe (or /formatsubscribe) for it
+    unsigned long silentMillis;         // when it was found silent; 0 if it is not
+    uint8_t silentTries;                // subscribed again since
+  } subscriptions[SUBSCRIPTION_MAX];
+  volatile int count; // tick()'s task adds (see watch), the receiving task reads (see watched)
+  uint8_t mode;
+  bool active;
+  bool heard;                // has anything we subscribed to arrived?
+  unsigned long startMillis;
+  unsigned long renewMillis; // /xremote or /formatsubscribe deadline
+  volatile unsigned long lastHeardMillis;
+  bool expired;              // the X32 went away
+  volatile bool resubscribe; // watch list changed while active
+  bool recovering;           // subscribed again, waiting for traffic
+  unsigned long outageMillis; // last traffic before the expiry
+  uint32_t recoveries;
+  unsigned long recoverSumMillis;
+
+  long jitter()
+  {
+    return (long)(esp_random() % (2 * SUBSCRIPTION_JITTER_MS + 1)) - SUBSCRIPTION_JITTER_MS;
+  };
+
+  // receiving task: how many subscriptions there are, with their entries complete (watch() may add one meanwhile)
+  int watched()
+  {
+    int n = count;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return n;
+  };
+
+  // shorter as the link gets lossier, so that a lost renewal is followed by another before the X32 gives up
+  unsigned long renewInterval()
+  {
+    return SUBSCRIPTION_RENEW_MS - (SUBSCRIPTION_RENEW_MS - SUBSCRIPTION_RENEW_MIN_MS) * liveness.lossEstimate() / 100 + jitter();
+  };
+
+  // subscribe again to whatever has gone quiet, and time how long it takes to come back;
+  // returns true if something newly went quiet, so everything needs a resync
+  bool resubscribeSilent(unsigned long now)
+  {
+    bool resync = false;
+    bool formatDue = false;
+    int n = (mode == SUBSCRIBE_FORMAT && count) ? 1 : count; // one /formatsubscribe: its values arrive together
+    for (int s = 0; s < n; s++)
+    {
+      auto &sub = subscriptions[s];
+      unsigned long heardMillis = sub.heardMillis;
+      if (sub.silentMillis && (long)(heardMillis - sub.subscribedMillis) >= 0)
+      {
+        // first update since we subscribed again
+        recovered(heardMillis - sub.silentMillis, "lost renewal");
+        sub.silentMillis = 0;
+        sub.silentTries = 0;
+      }
+      if ((now - heardMillis) <= SUBSCRIPTION_SILENCE_MS || (now - sub.subscribedMillis) <= (SUBSCRIPTION_SILENCE_MS << ((sub.silentTries < 3) ? sub.silentTries : 3)))
+      {
+        continue;
+      }
+      if (!sub.silentMillis)
+      {
+        sub.silentMillis = now;
+        resync = true;
+        printMillis();
+        Serial.print(name);
+        Serial.print(": subscription silent for ");
+        Serial.print(now - heardMillis);
+        Serial.print(" ms, subscribing again");
+        if (mode == SUBSCRIBE_PER_ADDRESS)
+        {
+          ParamEntry e;
+          cache.get(sub.id, e);
+          Serial.print(" to ");
+          Serial.print(e.address);
+        }
+        Serial.println();
+      }
+      if (sub.silentTries < 255)
+      {
+        sub.silentTries++;
+      }
+      if (mode == SUBSCRIBE_PER_ADDRESS)
+      {
+        subscribeOne(s, true, now);
+      }
+      else
+      {
+        formatDue = true;
+      }
+    }
+    if (formatDue)
+    {
+      subscribe(true);
+    }
+    return resync;
+  };
+
+  void forgetSilence()
+  {
+    for (int s = 0; s < count; s++)
+    {
+      subscriptions[s].silentMillis = 0;
+      subscriptions[s].silentTries = 0;
+    }
+  };
+
+  // a subscription is back; ms since it was lost
+  void recovered(unsigned long ms, const char *cause)
+  {
+    recoveries++;
+    recoverSumMillis += ms;
+    printMillis();
+    Serial.print(name);
+    Serial.print(": subscription recovered from ");
+    Serial.print(cause);
+    Serial.print(" after ");
+    Serial.print(ms);
+    Serial.print(" ms, mean ");
+    Serial.print(recoverSumMillis / recoveries);
+    Serial.print(" ms over ");
+    Serial.print(recoveries);
+    Serial.println(" recoveries");
+  };
+
+  // /subscribe (all) or /renew one address
+  void subscribeOne(int s, bool all, unsigned long now)
+  {
+    ParamEntry e;
+    cache.get(subscriptions[s].id, e);
+    if (all)
+    {
+      OSCMessage msg("/subscribe");
+      msg.add(e.address);
+      msg.add((int32_t)SUBSCRIPTION_TIME_FACTOR);
+      send(target, msg, TX_CLASS_RENEWAL);
+      subscriptions[s].subscribedMillis = now;
+    }
+    else
+    {
+      OSCMessage msg("/renew");
+      msg.add(e.address);
+      send(target, msg, TX_CLASS_RENEWAL);
+    }
+    subscriptions[s].deadline = now + renewInterval();
+  };
+
+  // send whatever is due; everything if all
+  void subscribe(bool all)
+  {
+    unsigned long now = millis();
+    ParamEntry e;
+    switch (mode)
+    {
+    case SUBSCRIBE_PER_ADDRESS:
+      for (int s = 0; s < count; s++)
+      {
+        if (!all && (long)(now - subscriptions[s].deadline) < 0)
+        {
+          continue;
+        }
+        subscribeOne(s, all, now);
+      }
+      break;
+
+    case SUBSCRIBE_FORMAT:
+      if (!all && (long)(now - renewMillis) < 0)
+      {
+        break;
+      }
+      if (all)
+      {
+        OSCMessage msg("/formatsubscribe");
+        msg.add(FORMAT_SUBSCRIPTION_NAME);
+        for (int s = 0; s < count; s++)
+        {
+          cache.get(subscriptions[s].id, e);
+          msg.add(e.address);
+        }
+        msg.add((int32_t)0); // no ** ranges
+        msg.add((int32_t)0);
+        msg.add((int32_t)SUBSCRIPTION_TIME_FACTOR);
+        send(target, msg, TX_CLASS_RENEWAL);
+        for (int s = 0; s < count; s++)
+        {
+          subscriptions[s].subscribedMillis = now;
+        }
+      }
+      else
+      {
+        OSCMessage msg("/renew");
+        msg.add(FORMAT_SUBSCRIPTION_NAME);
+        send(target, msg, TX_CLASS_RENEWAL);
+      }
+      renewMillis = now + renewInterval();
+      break;
+
+    default:
+      if (!all && (long)(now - renewMillis) < 0)
+      {
+        break;
+      }
+      {
+        // if we can be one of the allowed xRemote clients then renew the /xremote request
+        Serial.print("/xremote\b\b\b\b\b\b\b\b");
+        OSCMessage msg("/xremote");
+        send(target, msg, TX_CLASS_RENEWAL);
+      }
+      renewMillis = now + renewInterval();
+    }
+  };
+};
+
+// LED changes are queued by whichever task decides them, and made by the task that owns the LEDs (ledPoll)
+#define LED_QUEUE_SIZE 32 // must be a power of 2
+
+struct LedCommand
+{
+  uint8_t pin;
+  uint8_t level;           // LED_PIN_ON or LED_PIN_OFF
+  uint16_t flashMillis;    // if not 0, back to LED_PIN_OFF after this long
+  uint8_t blinks;          // if not 0, blink this many times (flashMillis on, flashMillis off), then stay at level
+};
+
+// packets to the consoles are formatted by whoever sends them, queued whole, and sent by one task (the TX owner)
+#define TX_PACKET_MAX 640   // bytes; enough for /formatsubscribe with SUBSCRIPTION_MAX addresses
+#define TX_USER_SIZE 4      // queued packets per class (TX_CLASS_...); each must be a power of 2
+#define TX_RENEWAL_SIZE 8   // e.g. a /subscribe per watched address
+#define TX_REFRESH_SIZE 4   // REFRESH_WINDOW queries at a time
+#define TX_TELEMETRY_SIZE 2
+#define TX_RATE 200         // packets per second the rate limit lets through, sustained
+#define TX_BURST 16         // packets it lets through at once after a quiet spell
+#define TX_COST_MICROS (1000000UL / TX_RATE)
+#define RX_PACKET_MAX 1024  // longest packet we receive
+#define TX_FULL_RETRIES 5   // background senders wait up to this many ticks for room; user actions never wait
+#define RX_QUEUE_SIZE 8     // raw transport: packets waiting for the UDP task, which takes them all each pass; must be a power of 2
+#define TX_COPIES 1         // lossy WiFi: send TX_IDEMPOTENT packets this many times, instead of waiting for a resend; 1 = once
+#define TX_COPY_SPACING_MS 10 // between copies, so one burst of loss does not take them all
+#define TX_COPY_SLOTS 4     // packets with copies still to send at once; more than that go once only
+#define TX_COPY_KEYS 8      // addresses remembered per packet with copies, to cancel them when a newer value is sent
+#define TX_LOSS_PERCENT 0   // testing: lose this share of packets (and copies) on the way out, e.g. to measure TX_COPIES against the X32 emulator
+#define RX_DUPLICATE_SLOTS 16 // addresses remembered, to drop the repeated answers to copies
+#define RX_DUPLICATE_MS (TX_COPIES * TX_COPY_SPACING_MS + 50)
+
+// how packets get to and from lwIP
+#define TRANSPORT_SOCKET 0  // BSD sockets, as WiFiUDP uses
+#define TRANSPORT_RAW 1     // lwIP raw API: udp_sendto without the socket and netconn layers
+#define TRANSPORT TRANSPORT_SOCKET // raw only once the "tx send" times and rx drops in the log show it is better
+
+struct TxPacket
+{
+  uint32_t address;          // destination, as IPAddress holds it
+  uint16_t port;
+  uint16_t length;
+  unsigned long pressMicros; // for presses, when the press happened at the latest; otherwise 0
+  uint8_t copies;            // times to send it again after the first (TX_COPIES, if TX_IDEMPOTENT)
+  uint8_t data[TX_PACKET_MAX];
+};
+
+class TxPacketWriter : public Print
+{
+  // lets OSCMessage::send() format straight into a TxPacket, from the start or (append) after what is there
+public:
+  TxPacketWriter(TxPacket &thePacket, uint16_t theLimit = TX_PACKET_MAX, bool append = false)
+      : packet(thePacket), limit(theLimit), overflow(false)
+  {
+    if (!append)
+    {
+      packet.length = 0;
+    }
+  };
+
+  size_t write(uint8_t b)
+  {
+    if (packet.length >= limit)
+    {
+      overflow = true;
+      return 0;
+    }
+    packet.data[packet.length++] = b;
+    return 1;
+  };
+
+  size_t write(const uint8_t *buffer, size_t size)
+  {
+    if (packet.length + size > limit)
+    {
+      overflow = true;
+      return 0;
+    }
+    memcpy(packet.data + packet.length, buffer, size);
+    packet.length += size;
+    return size;
+  };
+
+  bool overflowed() { return overflow; };
+
+private:
+  TxPacket &packet;
+  uint16_t limit;
+  bool overflow;
+};
+
+// OSC bundles: several messages for one console in one datagram
+#define OSC_BUNDLES true        // pack multi-message actions into #bundle datagrams; false if a console ignores bundles
+#define OSC_BUNDLE_MTU 512      // longest bundle we send; well under the WiFi MTU, so never fragmented
+#define OSC_BUNDLE_HEADER 16    // "#bundle" and its terminator, then the time tag
+#define OSC_BUNDLE_DEPTH 4      // bundles inside bundles we unpack
+
+static_assert(OSC_BUNDLE_MTU <= TX_PACKET_MAX, "OSC_BUNDLE_MTU must fit a TxPacket");
+
+class OscBundle
+{
+  // formats a #bundle into a TxPacket, one message at a time
+  // - time tag 1, "immediately": the console applies the messages together, in order, as it gets the datagram
+  // - each element is its length (big-endian int32) followed by the message
+public:
+  OscBundle(TxPacket &thePacket) : packet(thePacket), count(0)
+  {
+    clear();
+  };
+
+  void clear()
+  {
+    static const uint8_t header[OSC_BUNDLE_HEADER] = {'#', 'b', 'u', 'n', 'd', 'l', 'e', 0, 0, 0, 0, 0, 0, 0, 0, 1};
+    memcpy(packet.data, header, OSC_BUNDLE_HEADER);
+    packet.length = OSC_BUNDLE_HEADER;
+    count = 0;
+  };
+
+  // false if the message does not fit in OSC_BUNDLE_MTU; the bundle is left as it was
+  bool add(OSCMessage &msg)
+  {
+    uint16_t start = packet.length;
+    if (start + 4 > OSC_BUNDLE_MTU)
+    {
+      return false;
+    }
+    packet.length += 4;
+    TxPacketWriter writer(packet, OSC_BUNDLE_MTU, true);
+    msg.send(writer);
+    if (writer.overflowed())
+    {
+      packet.length = start;
+      return false;
+    }
+    uint32_t length = packet.length - start - 4;
+    packet.data[start] = length >> 24;
+    packet.data[start + 1] = length >> 16;
+    packet.data[start + 2] = length >> 8;
+    packet.data[start + 3] = length;
+    count++;
+    return true;
+  };
+
+  int size() { return count; };
+
+private:
+  TxPacket &packet;
+  int count;
+};
+
+class LatencyStats
+{
+  // count, mean and worst of a latency, e.g. button press to packet sent
+public:
+  LatencyStats() : samples(0), maxMicros(0), sumMicros(0) {};
+
+  void sample(unsigned long theMicros)
+  {
+    portENTER_CRITICAL(&mux);
+    samples++;
+    sumMicros += theMicros;
+    if (theMicros > maxMicros)
+    {
+      maxMicros = theMicros;
+    }
+    portEXIT_CRITICAL(&mux);
+  };
+
+  // print and start again
+  void print(const char *name)
+  {
+    portENTER_CRITICAL(&mux);
+    uint32_t n = samples;
+    unsigned long worst = maxMicros;
+    uint64_t sum = sumMicros;
+    samples = 0;
+    maxMicros = 0;
+    sumMicros = 0;
+    portEXIT_CRITICAL(&mux);
+    Serial.print(name);
+    Serial.print(" ");
+    Serial.print(n);
+    Serial.print(" samples, mean ");
+    Serial.print((n) ? (unsigned long)(sum / n) : 0);
+    Serial.print(" us, max ");
+    Serial.print(worst);
+    Serial.println(" us");
+  };
+
+private:
+  uint32_t samples;
+  unsigned long maxMicros;
+  uint64_t sumMicros;
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+class SocketTransport
+{
+  // BSD socket backend: one socket, bound to the port the consoles answer
+public:
+  SocketTransport() : fd(-1) {};
+
+  // open and bind once; the socket survives WiFi reconnecting
+  bool begin(uint16_t localPort)
+  {
+    if (fd >= 0)
+    {
+      return true;
+    }
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s < 0)
+    {
+      return false;
+    }
+    int yes = 1;
+    setsockopt(s, SOL_SOCKET, SO_BROADCAST, &yes, sizeof(yes)); // relay traffic is broadcast
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons(localPort);
+    local.sin_addr.s_addr = INADDR_ANY;
+    if (bind(s, (struct sockaddr *)&local, sizeof(local)) < 0)
+    {
+      close(s);
+      return false;
+    }
+    fd = s;
+    return true;
+  };
+
+  // next packet if there is one (does not wait); returns its length, or 0
+  int receive(uint8_t *buffer, size_t size, IPAddress &fromAddress, uint16_t &fromPort)
+  {
+    if (fd < 0)
+    {
+      return 0;
+    }
+    struct sockaddr_in from;
+    socklen_t fromLength = sizeof(from);
+    int length = recvfrom(fd, buffer, size, MSG_DONTWAIT, (struct sockaddr *)&from, &fromLength);
+    if (length <= 0)
+    {
+      return 0;
+    }
+    fromAddress = IPAddress(from.sin_addr.s_addr);
+    fromPort = ntohs(from.sin_port);
+    return length;
+  };
+
+  bool send(const uint8_t *data, uint16_t length, uint32_t address, uint16_t port)
+  {
+    if (fd < 0)
+    {
+      return false;
+    }
+    struct sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_port = htons(port);
+    to.sin_addr.s_addr = address;
+    return sendto(fd, data, length, 0, (struct sockaddr *)&to, sizeof(to)) == length;
+  };
+
+  // packets lost before receive() saw them; the socket does not tell us
+  uint32_t receiveDropped() { return 0; };
+
+  const char *name() { return "socket"; };
+
+private:
+  int fd;
+};
+
+struct RawRxPacket
+{
+  struct pbuf *p;
+  uint32_t address;
+  uint16_t port;
+};
+
+class RawTransport
+{
+  // lwIP raw API backend
+  // - the raw API may only be used on the tcpip thread: begin() and send() run there through tcpip_api_call,
+  //   which waits for them (a round trip to that thread per packet, as with sockets)
+  // - each packet is copied once, into a PBUF_RAM pbuf with room in front for the UDP and IP headers: one
+  //   contiguous pbuf the WiFi driver can take as it is (a PBUF_REF payload with headers chained in front
+  //   would be copied again by the driver to flatten the chain)
+  // - received pbufs are queued as lwIP hands them over, and copied out (and freed) by receive()
+  // - whether this beats the socket backend is for the "tx send" times in the log to say
+public:
+  RawTransport() : pcb(NULL), rxDropped(0) {};
+
+  // open and bind once; the pcb survives WiFi reconnecting
+  bool begin(uint16_t localPort)
+  {
+    if (pcb)
+    {
+      return true;
+    }
+    RawCall call;
+    call.transport = this;
+    call.port = localPort;
+    tcpip_api_call(beginApi, &call.api);
+    return call.err == ERR_OK;
+  };
+
+  // next packet if there is one (does not wait); returns its length, or 0
+  int receive(uint8_t *buffer, size_t size, IPAddress &fromAddress, uint16_t &fromPort)
+  {
+    RawRxPacket rx;
+    if (!rxQueue.pop(rx))
+    {
+      return 0;
+    }
+    int length = pbuf_copy_partial(rx.p, buffer, size, 0);
+    pbuf_free(rx.p);
+    fromAddress = IPAddress(rx.address);
+    fromPort = rx.port;
+    return length;
+  };
+
+  bool send(const uint8_t *data, uint16_t length, uint32_t address, uint16_t port)
+  {
+    RawCall call;
+    call.transport = this;
+    call.data = data;
+    call.length = length;
+    call.address = address;
+    call.port = port;
+    tcpip_api_call(sendApi, &call.api);
+    return call.err == ERR_OK;
+  };
+
+  // packets lost because the UDP task had RX_QUEUE_SIZE waiting already
+  uint32_t receiveDropped() { return rxDropped; };
+
+  const char *name() { return "raw"; };
+
+private:
+  struct RawCall
+  {
+    struct tcpip_api_call_data api; // first, as lwIP hands us back a pointer to it
+    RawTransport *transport;
+    const uint8_t *data;
+    uint16_t length;
+    uint32_t address;
+    uint16_t port;
+    err_t err;
+  };
+
+  // tcpip thread
+  static err_t beginApi(struct tcpip_api_call_data *api)
+  {
+    RawCall *call = (RawCall *)api;
+    RawTransport *t = call->transport;
+    struct udp_pcb *newPcb = udp_new();
+    if (!newPcb)
+    {
+      call->err = ERR_MEM;
+      return call->err;
+    }
+    ip_set_option(newPcb, SOF_BROADCAST); // relay traffic is broadcast
+    call->err = udp_bind(newPcb, IP_ANY_TYPE, call->port);
+    if (call->err != ERR_OK)
+    {
+      udp_remove(newPcb);
+      return call->err;
+    }
+    udp_recv(newPcb, receiveCallback, t);
+    t->pcb = newPcb;
+    return call->err;
+  };
+
+  // tcpip thread
+  static err_t sendApi(struct tcpip_api_call_data *api)
+  {
+    RawCall *call = (RawCall *)api;
+    RawTransport *t = call->transport;
+    if (!t->pcb)
+    {
+      call->err = ERR_VAL;
+      return call->err;
+    }
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, call->length, PBUF_RAM); // header room reserved in front
+    if (!p)
+    {
+      call->err = ERR_MEM;
+      return call->err;
+    }
+    pbuf_take(p, call->data, call->length);
+    ip_addr_t to;
+    ip_addr_set_ip4_u32(&to, call->address);
+    call->err = udp_sendto(t->pcb, p, &to, call->port); // headers go in front, in the same pbuf
+    pbuf_free(p); // lwIP holds its own reference if it keeps it, e.g. waiting for ARP
+    return call->err;
+  };
+
+  // tcpip thread; the pbuf is ours from here
+  static void receiveCallback(void *arg, struct udp_pcb *fromPcb, struct pbuf *p, const ip_addr_t *address, uint16_t port)
+  {
+    RawTransport *t = (RawTransport *)arg;
+    RawRxPacket rx;
+    rx.p = p;
+    rx.address = ip_addr_get_ip4_u32(address);
+    rx.port = port;
+    if (!t->rxQueue.push(rx))
+    {
+      pbuf_free(p);
+      t->rxDropped++;
+    }
+  };
+
+  struct udp_pcb *pcb;   // tcpip thread's, apart from begin() seeing it is there
+  MpscQueue<RawRxPacket, RX_QUEUE_SIZE> rxQueue;
+  std::atomic<uint32_t> rxDropped;
+};
+
+#if TRANSPORT == TRANSPORT_RAW
+typedef RawTransport TransportBackend;
+#else
+typedef SocketTransport TransportBackend;
+#endif
+
+class Transport
+{
+  // to and from the consoles, through TransportBackend, on one port (they answer the port we send from)
+  // - receive() is only called by the receiving task; send() by anyone, as it only queues a finished packet
+  // - flush() is only called by the TX owner (taskTxLoop, or the reactor): one queue per class (TX_CLASS_...),
+  //   and the highest class waiting is looked for again before every packet, so a user action never waits
+  //   behind a refresh burst
+  // - a token bucket (TX_RATE, TX_BURST) limits what we send; user actions use up tokens but are never held back
+  // - packets with copies are kept after they are sent, and sent again every TX_COPY_SPACING_MS: the copies of
+  //   user actions before anything queued, the others only while no user action waits, and within the rate limit
+  // - a packet setting a value for an address cancels the copies still to come of any packet that set one for it
+  //   (keyed by console and address), so an older value never lands after a newer one
+  // - lwIP lets one task receive while another sends
+  // - how long formatting and sending take is logged, to compare the backends
+public:
+  Transport() : tooLong(0), errors(0), notReady(0), credit(TX_BURST * TX_COST_MICROS), refillMicros(0), copiesSent(0), copiesSkipped(0), copiesCancelled(0), lost(0)
+  {
+    for (auto &slot : copySlots)
+    {
+      slot.left = 0;
+    }
+    for (int c = 0; c < TX_CLASSES; c++)
+    {
+      depth[c] = 0;
+      maxDepth[c] = 0;
+      dropped[c] = 0;
+      sent[c] = 0;
+      held[c] = 0;
+    }
+  };
+
+  bool begin(uint16_t localPort) { return backend.begin(localPort); };
+
+  int receive(uint8_t *buffer, size_t size, IPAddress &fromAddress, uint16_t &fromPort)
+  {
+    return backend.receive(buffer, size, fromAddress, fromPort);
+  };
+
+  // queue a finished packet; false if there is no room (never waits)
+  bool send(const TxPacket &packet, uint8_t txClass)
+  {
+    bool queued;
+    switch (txClass)
+    {
+    case TX_CLASS_USER:
+      queued = userQueue.push(packet);
+      break;
+    case TX_CLASS_RENEWAL:
+      queued = renewalQueue.push(packet);
+      break;
+    case TX_CLASS_REFRESH:
+      queued = refreshQueue.push(packet);
+      break;
+    default:
+      txClass = TX_CLASS_TELEMETRY;
+      queued = telemetryQueue.push(packet);
+    }
+    if (queued)
+    {
+      // counted after the push, so the TX owner never sees a depth with no packet behind it
+      uint8_t d = ++depth[txClass];
+      uint8_t m = maxDepth[txClass];
+      while (d > m && !maxDepth[txClass].compare_exchange_weak(m, d))
+      {
+      }
+    }
+    return queued;
+  };
+
+  // nothing queued (any task; copies still to come are not counted)
+  bool idle()
+  {
+    for (int c = 0; c < TX_CLASSES; c++)
+    {
+      if (depth[c])
+      {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  void countDropped(uint8_t txClass) { dropped[txClass]++; };
+  void countTooLong() { tooLong++; };
+  void sampleFormat(unsigned long theMicros) { formatStats.sample(theMicros); };
+
+  // TX owner only: send the user copies that are due, then everything queued that the rate limit lets through,
+  // highest class first, with the background copies that are due ahead of the background queues
+  // returns 0, or how many ms until the next copy is due, the rate limit lets the next held-back packet through,
+  // or a packet counted but not yet published should be there
+  // pressSent, if given, is told when each press went out
+  unsigned long flush(void (*pressSent)(unsigned long pressMicros) = NULL)
+  {
+    unsigned long copyMillis;
+    unsigned long backgroundMillis = 0;
+    while (sendCopy(true, copyMillis))
+    {
+    }
+    for (;;)
+    {
+      uint8_t c = 0;
+      while (c < TX_CLASSES && depth[c] == 0)
+      {
+        c++;
+      }
+      if (c != TX_CLASS_USER && sendCopy(false, backgroundMillis))
+      {
+        continue; // one at a time, looking for a user action again after each
+      }
+      if (c == TX_CLASSES)
+      {
+        return soonest(copyMillis, backgroundMillis);
+      }
+      refill();
+      if (c != TX_CLASS_USER && credit < TX_COST_MICROS)
+      {
+        held[c]++;
+        return soonest(soonest(copyMillis, backgroundMillis), (TX_COST_MICROS - credit) / 1000 + 1);
+      }
+      if (!pop(c))
+      {
+        // counted, but the producer ahead of it in the queue has not published its slot yet: try again shortly,
+        // rather than send what is left in packet
+        notReady++;
+        return 1;
+      }
+      credit = (credit > TX_COST_MICROS) ? credit - TX_COST_MICROS : 0;
+      depth[c]--;
+
+      if (!transmit(packet))
+      {
+        continue;
+      }
+      sent[c]++;
+      uint32_t keys[TX_COPY_KEYS];
+      uint8_t keyCount = (TX_COPIES > 1) ? setKeys(packet, keys) : 0;
+      cancelCopies(keys, keyCount);
+      if (packet.copies && copyLater(c, keys, keyCount))
+      {
+        copyMillis = soonest(copyMillis, TX_COPY_SPACING_MS);
+      }
+      if (packet.pressMicros && pressSent)
+      {
+        pressSent(packet.pressMicros);
+      }
+    }
+  };
+
+  void print()
+  {
+    static const char *className[TX_CLASSES] = {"user", "renewal", "refresh", "telemetry"};
+    for (int c = 0; c < TX_CLASSES; c++)
+    {
+      // max depth since the last print; held is how often the rate limit made it wait
+      Serial.print("tx ");
+      Serial.print(className[c]);
+      Serial.print(" ");
+      Serial.print(sent[c]);
+      Serial.print(" sent, ");
+      Serial.print(dropped[c]);
+      Serial.print(" dropped (queue full), ");
+      Serial.print(held[c]);
+      Serial.print(" held, depth ");
+      Serial.print(depth[c]);
+      Serial.print(" max ");
+      Serial.println(maxDepth[c].exchange(depth[c]));
+    }
+    Serial.print("tx ");
+    Serial.print(tooLong);
+    Serial.print(" too long, ");
+    Serial.print(errors);
+    Serial.print(" send errors, ");
+    Serial.print(notReady);
+    Serial.print(" not ready; rx ");
+    Serial.print(backend.receiveDropped());
+    Serial.print(" dropped; ");
+    Serial.print(backend.name());
+    Serial.println(" backend");
+    if (TX_COPIES > 1 || TX_LOSS_PERCENT)
+    {
+      Serial.print("tx ");
+      Serial.print(copiesSent);
+      Serial.print(" copies sent, ");
+      Serial.print(copiesSkipped);
+      Serial.print(" packets not copied (slots busy), ");
+      Serial.print(copiesCancelled);
+      Serial.print(" cancelled (newer value), ");
+      Serial.print(lost);
+      Serial.println(" lost on purpose (TX_LOSS_PERCENT)");
+    }
+    formatStats.print("tx format");
+    sendStats.print("tx send");
+  };
+
+private:
+  // TX owner: next packet of class c into packet; false if it is not there yet
+  bool pop(uint8_t c)
+  {
+    switch (c)
+    {
+    case TX_CLASS_USER:
+      return userQueue.pop(packet);
+    case TX_CLASS_RENEWAL:
+      return renewalQueue.pop(packet);
+    case TX_CLASS_REFRESH:
+      return refreshQueue.pop(packet);
+    default:
+      return telemetryQueue.pop(packet);
+    }
+  };
+
+  // TX owner: hand one packet to lwIP; false if that failed
+  bool transmit(const TxPacket &p)
+  {
+    if (TX_LOSS_PERCENT && esp_random() % 100 < TX_LOSS_PERCENT)
+    {
+      lost++; // as if the WiFi had lost it
+      return true;
+    }
+    unsigned long startMicros = micros();
+    bool ok = backend.send(p.data, p.length, p.address, p.port);
+    sendStats.sample(micros() - startMicros);
+    if (!ok)
+    {
+      errors++;
+    }
+    return ok;
+  };
+
+  // TX owner: keep the packet just sent (of class c, setting keys) for its copies; false if every slot is busy
+  bool copyLater(uint8_t c, const uint32_t *keys, uint8_t keyCount)
+  {
+    for (auto &slot : copySlots)
+    {
+      if (!slot.left)
+      {
+        slot.packet = packet;
+        slot.txClass = c;
+        memcpy(slot.keys, keys, keyCount * sizeof(uint32_t));
+        slot.keyCount = keyCount;
+        slot.left = packet.copies;
+        slot.dueMicros = micros() + TX_COPY_SPACING_MS * 1000UL;
+        return true;
+      }
+    }
+    copiesSkipped++;
+    return false;
+  };
+
+  // TX owner: drop the copies still to come of packets setting any of these keys
+  void cancelCopies(const uint32_t *keys, uint8_t keyCount)
+  {
+    for (auto &slot : copySlots)
+    {
+      for (uint8_t k = 0; slot.left && k < slot.keyCount; k++)
+      {
+        for (uint8_t j = 0; j < keyCount; j++)
+        {
+          if (slot.keys[k] == keys[j])
+          {
+            slot.left = 0;
+            copiesCancelled++;
+            break;
+          }
+        }
+      }
+    }
+  };
+
+  // what p sets a value for (messages with arguments, not queries), as hashes of console and address;
+  // returns how many, up to TX_COPY_KEYS
+  static uint8_t setKeys(const TxPacket &p, uint32_t *keys)
+  {
+    if (p.length < OSC_BUNDLE_HEADER || memcmp(p.data, "#bundle", 8) != 0)
+    {
+      return setKey(p, p.data, p.length, keys);
+    }
+    uint8_t n = 0;
+    uint16_t i = OSC_BUNDLE_HEADER;
+    while (i + 4 <= p.length && n < TX_COPY_KEYS)
+    {
+      uint32_t length = ((uint32_t)p.data[i] << 24) | ((uint32_t)p.data[i + 1] << 16) | ((uint32_t)p.data[i + 2] << 8) | p.data[i + 3];
+      i += 4;
+      if (length > (uint32_t)(p.length - i))
+      {
+        break;
+      }
+      n += setKey(p, p.data + i, length, keys + n);
+      i += length;
+    }
+    return n;
+  };
+
+  // one message: 1 and its key if it sets a value, otherwise 0
+  static uint8_t setKey(const TxPacket &p, const uint8_t *msg, uint16_t length, uint32_t *key)
+  {
+    uint16_t tags = 0;
+    while (tags < length && msg[tags])
+    {
+      tags++;
+    }
+    tags = (tags + 4) & ~3; // the address is padded to a multiple of 4, terminator included
+    if (tags + 1 >= length || msg[tags] != ',' || !msg[tags + 1])
+    {
+      return 0; // a query, or not a message we formatted
+    }
+    *key = ParamCache::hash((const char *)msg) ^ p.address ^ p.port;
+    return 1;
+  };
+
+  // TX owner: send one due copy of a user action (user), or of anything else (!user); false if none is due, with
+  // wait set to 0, or how many ms until the next one of that kind is
+  // - the others keep to the rate limit, as the rest of their class does
+  bool sendCopy(bool user, unsigned long &wait)
+  {
+    wait = 0;
+    refill();
+    unsigned long now = micros();
+    for (auto &slot : copySlots)
+    {
+      if (!slot.left || (slot.txClass == TX_CLASS_USER) != user)
+      {
+        continue;
+      }
+      long early = (long)(slot.dueMicros - now);
+      if (early <= 0 && !user && credit < TX_COST_MICROS)
+      {
+        early = TX_COST_MICROS - credit;
+      }
+      if (early <= 0)
+      {
+        credit = (credit > TX_COST_MICROS) ? credit - TX_COST_MICROS : 0;
+        if (transmit(slot.packet))
+        {
+          copiesSent++;
+        }
+        slot.left--;
+        slot.dueMicros = now + TX_COPY_SPACING_MS * 1000UL;
+        return true;
+      }
+      wait = soonest(wait, early / 1000 + 1);
+    }
+    return false;
+  };
+
+  // the sooner of two waits in ms, where 0 is none
+  static unsigned long soonest(unsigned long a, unsigned long b)
+  {
+    return (a && (!b || a < b)) ? a : b;
+  };
+
+  // TX owner: one packet's worth of credit (TX_COST_MICROS) comes back every TX_COST_MICROS, up to TX_BURST packets
+  void refill()
+  {
+    unsigned long now = micros();
+    unsigned long elapsed = now - refillMicros;
+    refillMicros = now;
+    credit = (elapsed >= TX_BURST * TX_COST_MICROS - credit) ? TX_BURST * TX_COST_MICROS : credit + elapsed;
+  };
+
+  TransportBackend backend;
+  MpscQueue<TxPacket, TX_USER_SIZE> userQueue;
+  MpscQueue<TxPacket, TX_RENEWAL_SIZE> renewalQueue;
+  MpscQueue<TxPacket, TX_REFRESH_SIZE> refreshQueue;
+  MpscQueue<TxPacket, TX_TELEMETRY_SIZE> telemetryQueue;
+  TxPacket packet; // TX owner's: the one being sent, from pop() to transmit()
+  std::atomic<uint8_t> depth[TX_CLASSES];    // queued now
+  std::atomic<uint8_t> maxDepth[TX_CLASSES];
+  std::atomic<uint32_t> dropped[TX_CLASSES];
+  uint32_t sent[TX_CLASSES];
+  uint32_t held[TX_CLASSES];
+  std::atomic<uint32_t> tooLong;
+  uint32_t errors;
+  uint32_t notReady;          // flush found a counted packet not yet published
+  unsigned long credit;       // rate limit tokens, in microseconds of TX_COST_MICROS each
+  unsigned long refillMicros;
+  LatencyStats formatStats; // OSC message to queued packet, in the sending task
+  LatencyStats sendStats;   // queued packet to lwIP done with it, in the TX owner
+  struct
+  {
+    TxPacket packet;
+    uint8_t txClass;
+    uint8_t left;             // copies still to send; 0 if free
+    unsigned long dueMicros;
+    uint32_t keys[TX_COPY_KEYS]; // what it sets (setKeys)
+    uint8_t keyCount;
+  } copySlots[TX_COPY_SLOTS]; // TX owner's
+  uint32_t copiesSent;
+  uint32_t copiesSkipped;
+  uint32_t copiesCancelled;
+  uint32_t lost;
+};
+
+// continuous parameters: values for one address are coalesced, the last written wins
+#define COALESCE_SLOTS 8        // addresses being coalesced at once
+#define COALESCE_MIN_MS 20      // default minimum interval between two values for one address (50 per second)
+
+struct CoalesceSlot
+{
+  paramId_t id;                // PARAM_NONE if free
+  bool pending;                // value has not been sent yet
+  float value;
+  unsigned long pressMicros;   // for presses, when the press happened; otherwise 0
+  uint16_t minIntervalMs;
+  unsigned long sentMillis;
+};
+
+class Coalescer
+{
+  // last writer wins, per address, for streams of values (fader widgets, pedal sweeps, ramps)
+  // - set() sends straight away if the address has been quiet for its minimum interval; otherwise the value
+  //   waits in the address's slot, and a newer one replaces it in place
+  // - poll() sends the waiting values whose interval is up, so the last value written always gets out
+  // - any task can set(); one task polls
+  // - if every slot is busy the value is sent as it is, uncoalesced
+public:
+  typedef void (*FloatSender)(paramId_t id, float value, unsigned long pressMicros);
+
+  Coalescer(FloatSender theSender) : send(theSender), writes(0), replaced(0), full(0)
+  {
+    for (int s = 0; s < COALESCE_SLOTS; s++)
+    {
+      slots[s].id = PARAM_NONE;
+      slots[s].pending = false;
+    }
+  };
+
+  void set(paramId_t id, float value, unsigned long pressMicros = 0, uint16_t minIntervalMs = COALESCE_MIN_MS)
+  {
+    unsigned long now = millis();
+    bool sendNow = true;
+    portENTER_CRITICAL(&mux);
+    writes++;
+    int s = find(id, now);
+    if (s < 0)
+    {
+      full++;
+    }
+    else
+    {
+      CoalesceSlot &slot = slots[s];
+      if (slot.id != id)
+      {
+        slot.id = id;
+        slot.sentMillis = now - minIntervalMs; // new to this slot: due now
+      }
+      if (slot.pending)
+      {
+        replaced++; // an obsolete value that will never be sent
+      }
+      slot.value = value;
+      slot.pressMicros = pressMicros;
+      slot.minIntervalMs = minIntervalMs;
+      sendNow = (now - slot.sentMillis >= slot.minIntervalMs);
+      slot.pending = !sendNow;
+      if (sendNow)
+      {
+        slot.sentMillis = now;
+      }
+    }
+    portEXIT_CRITICAL(&mux);
+    if (sendNow)
+    {
+      send(id, value, pressMicros);
+    }
+  };
+
+  void poll()
+  {
+    unsigned long now = millis();
+    for (int s = 0; s < COALESCE_SLOTS; s++)
+    {
+      CoalesceSlot due;
+      due.pending = false;
+      portENTER_CRITICAL(&mux);
+      CoalesceSlot &slot = slots[s];
+      if (slot.pending && now - slot.sentMillis >= slot.minIntervalMs)
+      {
+        slot.pending = false;
+        slot.sentMillis = now;
+        due = slot;
+        due.pending = true;
+      }
+      portEXIT_CRITICAL(&mux);
+      if (due.pending)
+      {
+        send(due.id, due.value, due.pressMicros);
+      }
+    }
+  };
+
+  // forget a value for id still waiting to be sent, e.g. when a fade takes the address over
+  void cancel(paramId_t id)
+  {
+    portENTER_CRITICAL(&mux);
+    for (int s = 0; s < COALESCE_SLOTS; s++)
+    {
+      if (slots[s].id == id && slots[s].pending)
+      {
+        slots[s].pending = false;
+        replaced++; // obsolete, as if a newer value had replaced it
+      }
+    }
+    portEXIT_CRITICAL(&mux);
+  };
+
+  // print and start again
+  void print()
+  {
+    portENTER_CRITICAL(&mux);
+    uint32_t w = writes;
+    uint32_t r = replaced;
+    uint32_t f = full;
+    writes = 0;
+    replaced = 0;
+    full = 0;
+    portEXIT_CRITICAL(&mux);
+    Serial.print("coalesce ");
+    Serial.print(w);
+    Serial.print(" values, ");
+    Serial.print(r);
+    Serial.print(" replaced before they were sent, ");
+    Serial.print(f);
+    Serial.println(" sent uncoalesced (no free slot)");
+  };
+
+private:
+  // the slot holding id, or one we can take over (nothing waiting, and its interval is up), or -1; under mux
+  int find(paramId_t id, unsigned long now)
+  {
+    int spare = -1;
+    for (int s = 0; s < COALESCE_SLOTS; s++)
+    {
+      if (slots[s].id == id)
+      {
+        return s;
+      }
+      if (spare < 0 && (slots[s].id == PARAM_NONE || (!slots[s].pending && now - slots[s].sentMillis >= slots[s].minIntervalMs)))
+      {
+        spare = s;
+      }
+    }
+    return spare;
+  };
+
+  FloatSender send;
+  CoalesceSlot slots[COALESCE_SLOTS];
+  uint32_t writes;
+  uint32_t replaced;
+  uint32_t full;
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+class PollStats
+{
+  // how often does a job get looked at? the gap between two polls bounds how long
+  // a button press or packet can wait, so the task model and the reactor can be compared
+public:
+  PollStats() : polls(0), lastMicros(0), maxGapMicros(0), sumGapMicros(0) {};
+
+  // call at the start of every poll
+  void tick()
+  {
+    unsigned long now = micros();
+    if (polls++)
+    {
+      unsigned long gap = now - lastMicros;
+      sumGapMicros += gap;
+      if (gap > maxGapMicros)
+      {
+        maxGapMicros = gap;
+      }
+    }
+    lastMicros = now;
+  };
+
+  // print and start again
+  void print(const char *name)
+  {
+    Serial.print(name);
+    Serial.print(" ");
+    Serial.print(polls);
+    Serial.print(" polls, gap mean ");
+    Serial.print((polls > 1) ? (unsigned long)(sumGapMicros / (polls - 1)) : 0);
+    Serial.print(" us, max ");
+    Serial.print(maxGapMicros);
+    Serial.println(" us");
+    polls = 0;
+    maxGapMicros = 0;
+    sumGapMicros = 0;
+  };
+
+private:
+  uint32_t polls;
+  unsigned long lastMicros;
+  unsigned long maxGapMicros;
+  uint64_t sumGapMicros;
+};
+
+extern ParamCache paramCache;
+extern std::atomic<uint8_t> activeBank;
+
+// console families, each with its own OSC address schema
+#define CONSOLE_X32 0
+#define CONSOLE_XAIR 1
+#define CONSOLE_WING 2
+#define CONSOLE_FAMILIES 3
+
+// fader law: X32 and X-Air faders are 0.0 - 1.0 in FADER_STEPS steps, four straight lines in dB
+#define FADER_STEPS 1024
+
+struct FaderSegment
+{
+  float from;      // fader position the line starts at
+  float dbPerUnit;
+  float dbOffset;  // dB = position * dbPerUnit + dbOffset
+};
+
+constexpr FaderSegment faderLaw[] = {
+    {0.5f, 40.0f, -30.0f},    // -10 dB to +10 dB
+    {0.25f, 80.0f, -50.0f},   // -30 dB to -10 dB
+    {0.0625f, 160.0f, -70.0f}, // -60 dB to -30 dB
+    {0.0f, 480.0f, -90.0f},   // -90 dB (off) to -60 dB
+};
+#define FADER_SEGMENTS (sizeof(faderLaw) / sizeof(faderLaw[0]))
+
+// steps per family; 0 is not quantised (Wing faders are in dB)
+constexpr uint16_t faderSteps[CONSOLE_FAMILIES] = {FADER_STEPS, FADER_STEPS, 0};
+
+float faderToDb(float position)
+{
+  for (unsigned s = 0; s < FADER_SEGMENTS; s++)
+  {
+    if (position >= faderLaw[s].from)
+    {
+      return position * faderLaw[s].dbPerUnit + faderLaw[s].dbOffset;
+    }
+  }
+  return faderLaw[FADER_SEGMENTS - 1].dbOffset;
+}
+
+float dbToFader(float db)
+{
+  for (unsigned s = 0; s < FADER_SEGMENTS; s++)
+  {
+    if (db >= faderLaw[s].from * faderLaw[s].dbPerUnit + faderLaw[s].dbOffset)
+    {
+      float position = (db - faderLaw[s].dbOffset) / faderLaw[s].dbPerUnit;
+      return (position > 1.0f) ? 1.0f : position;
+    }
+  }
+  return 0.0f;
+}
+
+// nearest position the console can hold
+float faderQuantise(float position, uint8_t family)
+{
+  uint16_t steps = faderSteps[family];
+  if (!steps)
+  {
+    return position;
+  }
+  if (position <= 0.0f)
+  {
+    return 0.0f;
+  }
+  if (position >= 1.0f)
+  {
+    return 1.0f;
+  }
+  return (float)(int)(position * (steps - 1) + 0.5f) / (steps - 1);
+}
+
+// logical parameters, so one pedalboard configuration works on any console family
+#define LP_NONE 0              // not logical; the widget's oscAddress is used as it is
+#define LP_CH_ON 1             // channel N on (not muted)
+#define LP_CH_FADER 2          // channel N fader, 0.0 - 1.0
+#define LP_BUS_ON 3            // mix bus N on
+#define LP_DCA_ON 4            // DCA N on
+#define LP_MUTE_GROUP 5        // mute group N engaged
+#define LP_MAIN_ON 6           // main stereo on
+#define LP_SHOW_CURRENT 7      // current scene / snapshot, changes on a show change
+#define LP_COUNT 8
+
+struct LogicalParam
+{
+  uint8_t kind;  // LP_CH_ON etc
+  uint8_t index; // channel, bus, DCA or mute group number, from 1
+};
+#define CH_ON(n) (LogicalParam{LP_CH_ON, n})
+#define CH_FADER(n) (LogicalParam{LP_CH_FADER, n})
+#define BUS_ON(n) (LogicalParam{LP_BUS_ON, n})
+#define DCA_ON(n) (LogicalParam{LP_DCA_ON, n})
+#define MUTE_GROUP(n) (LogicalParam{LP_MUTE_GROUP, n})
+#define MAIN_ON (LogicalParam{LP_MAIN_ON, 0})
+
+// macros: one press sets a list of parameters, in order
+#define MACRO_BATCH_MAX 24      // steps formatted at once; a longer run of undelayed steps goes out in several calls
+
+struct MacroStep
+{
+  LogicalParam param; // what to set; resolved for the console family when the macro runs
+  char type;          // 'i' or 'f'
+  float value;        // 'i' steps send it as an int
+  uint16_t delayMs;   // wait this long after the step before; 0 goes in the same bundle
+};
+#define STEP_ON(p) (MacroStep{p, 'i', 1, 0})
+#define STEP_OFF(p) (MacroStep{p, 'i', 0, 0})
+#define STEP_LEVEL(p, f) (MacroStep{p, 'f', f, 0})
+
+// the same step, delayMs after the one before
+constexpr MacroStep stepAfter(uint16_t delayMs, MacroStep step)
+{
+  return MacroStep{step.param, step.type, step.value, delayMs};
+}
+
+struct SchemaRule
+{
+  const char *format; // snprintf format taking the index, or NULL if the family has no such parameter
+  uint8_t maxIndex;   // 0 if the parameter takes no index
+  bool inverted;      // 1 means off where the X32 means on, or the other way round
+};
+
+// logical parameter -> address, per console family; resolved once in setup(), nothing to do per press
+const SchemaRule schemaRules[LP_COUNT][CONSOLE_FAMILIES] = {
+    //  X32                                  X-Air                                Wing
+    {{NULL, 0, false},                     {NULL, 0, false},                    {NULL, 0, false}},
+    {{"/ch/%02d/mix/on", 32, false},       {"/ch/%02d/mix/on", 16, false},      {"/ch/%d/mute", 40, true}},
+    {{"/ch/%02d/mix/fader", 32, false},    {"/ch/%02d/mix/fader", 16, false},   {NULL, 0, false}}, // Wing faders are in dB
+    {{"/bus/%02d/mix/on", 16, false},      {"/bus/%d/mix/on", 6, false},        {"/bus/%d/mute", 16, true}},
+    {{"/dca/%d/on", 8, false},             {"/dca/%d/on", 4, false},            {"/dca/%d/mute", 16, true}},
+    {{"/config/mute/%d", 6, false},        {"/config/mute/%d", 4, false},       {"/mgrp/%d/mute", 8, false}},
+    {{"/main/st/mix/on", 0, false},        {"/lr/mix/on", 0, false},            {"/main/1/mute", 0, true}},
+    {{"/-show/prepos/current", 0, false},  {"/-snap/index", 0, false},          {NULL, 0, false}}};
+
+// write the family's address for a logical parameter; false if it has no such parameter
+bool schemaResolve(LogicalParam param, uint8_t family, char *address, size_t len, bool &inverted)
+{
+  if (param.kind == LP_NONE || param.kind >= LP_COUNT || family >= CONSOLE_FAMILIES)
+  {
+    return false;
+  }
+  const SchemaRule &rule = schemaRules[param.kind][family];
+  if (!rule.format || (rule.maxIndex && (param.index < 1 || param.index > rule.maxIndex)))
+  {
+    return false;
+  }
+  inverted = rule.inverted;
+  return snprintf(address, len, rule.format, param.index) < (int)len;
+}
+
+#define TARGETS_MAX 4          // consoles one stompbox can drive
+#define TARGET_HASH_SIZE 8     // must be a power of 2 and larger than TARGETS_MAX
+#define X32_PORT 10023
+#define XAIR_PORT 10024
+#define WING_PORT 2223
+
+class ConsoleTarget
+{
+  // one console (X32, X-Air or Wing; see family) and our session with it
+  // - every target shares the one socket; replies are told apart by their source address (see targetFind)
+  // - each has its own liveness, subscriptions and share of paramCache (ParamEntry.target)
+  // - widgets pick a target by its index in consoleTargets
+  // depends on paramCache, sendOSC
+public:
+  const char *name;
+  IPAddress address;
+  uint16_t port;
+  uint8_t family;    // CONSOLE_X32, CONSOLE_XAIR or CONSOLE_WING; chooses the address schema
+  uint8_t index;     // position in consoleTargets, see begin()
+  ConsoleLiveness liveness;
+  SubscriptionManager subscriptions;
+  uint32_t rxPackets; // inbound traffic, for comparing subscription modes
+  uint32_t rxBytes;
+
+  ConsoleTarget(const char *theName, IPAddress theAddress, uint16_t thePort, uint8_t theFamily = CONSOLE_X32)
+      : name(theName),
+        address(theAddress),
+        port(thePort),
+        family(theFamily),
+        index(0),
+        liveness(sendOSC),
+        subscriptions(paramCache, liveness, sendOSC),
+        rxPackets(0),
+        rxBytes(0) {};
+
+  void begin(uint8_t theIndex)
+  {
+    index = theIndex;
+    liveness.begin(index, name);
+    subscriptions.begin(index, name);
+  };
+
+  void print()
+  {
+    Serial.print(index);
+    Serial.print(": ");
+    Serial.print(name);
+    Serial.print(" at ");
+    Serial.print(address);
+    Serial.print(":");
+    Serial.print(port);
+    Serial.print(", family ");
+    Serial.println(family);
+  };
+};
+
+class OSCWidget
+{
+  // depends on Button.h
+  // depends on paramCache
+  // depends on pinMode, ledWrite
+public:
+  char *friendlyDebugName; // e.g. Button 1, Button 2
+  uint8_t buttonPin;       // corresponding GPIO pin
+  uint8_t ledPin;          // corresponding GPIO pin
+  Button button;
+  int actionTrigger;       // action_PRESS or action_LONG_PRESS
+  unsigned long pressedMillis; // when was the button pressed?
+  bool wasPressed;
+
+  bool isOscToggle;   // is this a toggle (like Mute) or snippet
+  bool isReverseLed;  // LED state opposite to boolean state
+  char *oscAddress;   // OSC address
+  char *oscPayload_s; // OSC payload - relevent only for snippets
+  paramId_t paramId;  // oscAddress interned in paramCache, which holds the state (for toggle values like Mute)
+  int oscPayload_i;   // for loading snippets
+  float oscPayload_f; // for fader values
+  uint8_t bank;       // which bank this widget belongs to, or BANK_ALL
+  uint8_t target;     // which console it drives (index into consoleTargets)
+  LogicalParam logical; // if not LP_NONE, oscAddress is resolved from this for the target's family in setup()
+  char resolvedAddress[PARAM_ADDRESS_LEN];
+  uint16_t fadeMs;              // fader widgets: fade to oscPayload_f over this long, rather than jump (see rampStart)
+  const MacroStep *macro;       // if not NULL, a press runs these steps instead (they stay in flash)
+  uint8_t macroLength;
+  uint8_t macroNext;            // next step to run; macroLength when idle (see macroPoll)
+  unsigned long macroDueMillis; // when macroNext is due
+
+  OSCWidget(char *theFriendlyName,
+            int theButtonPin,
+            int theLedPin,
+            int theTrigger,
+            bool theOscType, 
+            bool theLedResponse,
+            char *theOscAddress,
+            char *theOscPayload_s,
+            int theOscIndex = -1,
+            float theOscPayload_f = -1,
+            uint8_t theBank = 0,
+            uint8_t theTarget = 0,
+            uint16_t theFadeMs = 0)
+      : button(theButtonPin),
+        friendlyDebugName(theFriendlyName),
+        buttonPin(theButtonPin),
+        ledPin(theLedPin),
+        actionTrigger(theTrigger),
+        isOscToggle(theOscType),
+        isReverseLed(theLedResponse),
+        oscAddress(theOscAddress),
+        oscPayload_s(theOscPayload_s),// use "" if not used
+        oscPayload_f(theOscPayload_f),// use -1 if not used
+        oscPayload_i(theOscIndex),    // use -1 if not used
+        paramId(PARAM_NONE),          // see setup()
+        bank(theBank),                // use 0 if not using banks
+        target(theTarget),            // use 0 if there is only one console
+        fadeMs(theFadeMs),            // use 0 to jump straight to oscPayload_f
+        wasPressed(false),
+        macro(NULL),
+        macroLength(0),
+        macroNext(0)
+  {
+    logical.kind = LP_NONE;
+    logical.index = 0;
+    resolvedAddress[0] = 0;
+    pinMode(buttonPin, INPUT_PULLUP); // initialise the pin for input
+    pinMode(ledPin, OUTPUT);          // initialise the pin for LED
+    button.begin();
+  };
+
+  // the same, for a logical parameter such as DCA_ON(5) in place of the address
+  OSCWidget(char *theFriendlyName,
+            int theButtonPin,
+            int theLedPin,
+            int theTrigger,
+            bool theOscType,
+            bool theLedResponse,
+            LogicalParam theParam,
+            char *theOscPayload_s,
+            int theOscIndex = -1,
+            float theOscPayload_f = -1,
+            uint8_t theBank = 0,
+            uint8_t theTarget = 0,
+            uint16_t theFadeMs = 0)
+      : OSCWidget(theFriendlyName, theButtonPin, theLedPin, theTrigger, theOscType, theLedResponse,
+                  resolvedAddress, theOscPayload_s, theOscIndex, theOscPayload_f, theBank, theTarget, theFadeMs)
+  {
+    logical = theParam;
+  };
+
+  // a macro: one press runs the steps of a const MacroStep array
+  template <size_t N>
+  OSCWidget(char *theFriendlyName,
+            int theButtonPin,
+            int theLedPin,
+            int theTrigger,
+            const MacroStep (&theSteps)[N],
+            uint8_t theBank = 0,
+            uint8_t theTarget = 0)
+      : OSCWidget(theFriendlyName, theButtonPin, theLedPin, theTrigger, false, false,
+                  (char *)"", (char *)"", -1, -1, theBank, theTarget)
+  {
+    static_assert(N < 256, "too many macro steps");
+    macro = theSteps;
+    macroLength = N;
+    macroNext = N;
+  };
+
+  // turn the logical parameter into this console family's address; false if it has none
+  bool resolve(uint8_t family)
+  {
+    bool inverted = false;
+    if (logical.kind == LP_NONE)
+    {
+      return true;
+    }
+    if (!schemaResolve(logical, family, resolvedAddress, PARAM_ADDRESS_LEN, inverted))
+    {
+      resolvedAddress[0] = 0;
+      return false;
+    }
+    isReverseLed ^= inverted; // isReverseLed is written for the X32 encoding
+    oscAddress = resolvedAddress; // again, in case this widget was copied
+    return true;
+  };
+
+  // queued for ledPoll (defined after ledWrite)
+  void doDigitalWrite(uint8_t val);
+
+  // does this widget respond in the currently selected bank?
+  bool isActive()
+  {
+    return bank == BANK_ALL || bank == activeBank;
+  };
+
+  // toggle state as last known in paramCache
+  int oscState()
+  {
+    return paramCache.getInt(paramId);
+  };
+
+  // show the toggle state from paramCache on the LED (defined after LED_PIN_ON)
+  uint8_t ledLevel();
+  void updateLed();
+
+  void print()
+  {
+    Serial.print(friendlyDebugName);
+    Serial.print(",\t");
+    Serial.print(buttonPin);
+    Serial.print(",\t");
+    Serial.print(ledPin);
+    Serial.print(",\t");
+    Serial.print(actionTrigger);
+    Serial.print(",\t");    
+    Serial.print(isOscToggle);
+    Serial.print(",\t");
+    Serial.print(isReverseLed);
+    Serial.print(",\t");
+    Serial.print(oscAddress);
+    if (macro)
+    {
+      Serial.print("macro, ");
+      Serial.print(macroLength);
+      Serial.print(" steps");
+    }
+    Serial.print(", ");
+    Serial.print(oscPayload_s);
+    Serial.print(", i ");
+    Serial.print(oscPayload_i);
+    Serial.print(", f ");
+    Serial.print(oscPayload_f);    
+    if (oscPayload_f >= 0)
+    {
+      Serial.print(" (");
+      Serial.print(faderToDb(oscPayload_f));
+      Serial.print(" dB)");
+    }
+    Serial.print(", bank ");
+    Serial.print(bank);
+    Serial.print(", target ");
+    Serial.print(target);
+    Serial.print(" (");
+    Serial.print(oscState());
+    Serial.println(")");
+  };
+};
+
+// MIDI OSC Hex converter
+char bigMidiCommand[64];                            // maximum command length in bytes
+char midiHeader[] = {0xF0, 0x00, 0x20, 0x32, 0x32}; // X32 OSC preamble
+char midiSpacer[] = {0x20};                         // X32 OSC spacer
+char midiFooter[] = {0xF7};                         // X32 OSC post-amble
+
+char *stringOFF = "OFF";
+char *stringON = "ON";
+
+#define action_NOTHING 0x00
+#define action_PRESS 0x01
+#define action_LONG_PRESS 0x02
+#define action_VLONG_PRESS 0x04
+#define mask_LONG_PRESS 0x06 // binary 0110
+#define LONG_PRESS_DURATION 1000  // 1 second
+#define VERY_LONG_PRESS_DURATION 3000 // 3 seconds
+
+#define NUMBER_OF_BANKS 2             // banks of widgets sharing the same buttons and LEDs
+#define BANK_GESTURE_DURATION 600     // flick modeButton away and back within this time to select the next bank
+
+// ***************************************************************
+// site settings, network configuration, etc
+// ***************************************************************
+char const *ssid = MYSSID;
+char const *pass = MYPASS;
+
+const IPAddress X32Address MYX32ADDRESS;
+const unsigned int X32Port = X32_PORT; // X-AIR is 10024, X32 is 10023
+const unsigned int localPort = 8888;   // local port to listen for OSC packets (also sends UDP from this port)
+
+// the consoles we drive, all from the one socket; widgets choose one by index (0 if not given)
+ConsoleTarget consoleTargets[] = {
+    ConsoleTarget("X32", X32Address, X32Port)};
+//    ConsoleTarget("XR18", IPAddress(192, 168, 32, 18), XAIR_PORT, CONSOLE_XAIR)};
+#define NUMBER_OF_TARGETS (sizeof(consoleTargets) / sizeof(consoleTargets[0]))
+static_assert(NUMBER_OF_TARGETS <= TARGETS_MAX, "too many consoleTargets");
+
+// relay: one stompbox (the master) holds the X32 subscription and re-publishes the updates
+// that other stompboxes (peers) have asked for, by broadcast on the LAN
+#define RELAY_NONE 0
+#define RELAY_MASTER 1
+#define RELAY_PEER 2
+#define RELAY_ROLE RELAY_NONE
+#define RELAY_PORT 10033          // local port for relay traffic, same on every stompbox
+#define RELAY_ANNOUNCE_MS 5000    // peers repeat their watch list this often (in case the master restarts)
+#undef RELAY_COMMANDS_VIA_MASTER  // peers send commands through the master, rather than straight to the X32
+#define RELAY_WATCH_QUEUE 8       // master: peers' watch requests waiting for pokePoll; must be a power of 2
+#define MY_HOSTNAME "X32_StompBox"
+
+// one task polls everything (taskReactorLoop), instead of a task per job; saves their stacks
+#undef USE_REACTOR
+#define STACK_TASK 10000        // bytes, for each task of the task model
+#define STACK_REACTOR 8192      // bytes: it runs one job at a time, so the deepest job's worth; see the "stack" log line
+#define REACTOR_RX_BUDGET 4     // packets handled per pass, so the buttons are never starved
+#define REACTOR_POKE_MS 10      // pokePoll this often, or straight away when a reply frees a refresh slot
+#define REACTOR_STATUS_MS 500   // statusPoll this often
+#define LED_FLASH_MAX 8         // LED flashes in progress at once
+#define LED_ERROR_BLINKS 3      // the console never took a command (see ackPoll)
+#define LED_ERROR_MS 60
+
+// fader fades (widgets with fadeMs), run by the buttons task or the reactor
+#define RAMP_SLOTS 8            // fades in progress at once; bounds the work per frame
+#define RAMP_FRAME_MS 20        // each fading fader moves once per frame (50 per second)
+
+// acknowledged delivery of toggles and /load: resent until the console's echo (or query reply) matches
+#define ACK_SLOTS 8             // commands awaiting acknowledgement at once
+#define ACK_FIRST_MS 80         // resend if not acknowledged within this time, doubling each time
+#define ACK_MAX_MS 1000         // up to this
+#define ACK_RETRIES 5           // then give up
+
+// scheduling plan; WiFi and lwIP run on core 0, setup() and loop() on core 1
+#define SCHEDULE_PLAN true      // false: every task at priority 1 on whichever core is free, as before
+#define CORE_NETWORK 0          // receiving, refresh queries and subscriptions, next to lwIP
+#define CORE_INPUT 1            // buttons, LEDs and status
+#define PRIORITY_BUTTONS 3      // the button-to-send path comes first
+#define PRIORITY_TX 3           // sending is the end of the button-to-send path
+#define PRIORITY_NETWORK 2
+#define PRIORITY_BACKGROUND 1   // status, LED flashes
+#define TASK_STATS_MAX 24       // tasks we can report the CPU share of
+
+// ***************************************************************
+// payload and button configuration, including pin configuration
+// ***************************************************************
+// macros: one press sets every step, in order; steps without a delay go out together (see MacroStep)
+const MacroStep bandOff[] = {
+    STEP_OFF(CH_ON(9)),
+    STEP_OFF(CH_ON(10)),
+    STEP_OFF(CH_ON(11)),
+    STEP_OFF(CH_ON(12)),
+    STEP_ON(MUTE_GROUP(6)),
+    stepAfter(1000, STEP_LEVEL(CH_FADER(13), 0.0)), // and a second later, the band vocal down
+};
+
+OSCWidget myWidgets[] = {
+    //         friendly_name      action_trigger                    oscAddress
+    //                    button_pin                  isOscToggle                           payload_s
+    //                        led_pin                        isReverseLed                         [payload_i], [payload_f]
+    OSCWidget("Bttn A__", 12, 13, action_VLONG_PRESS, false, false, "/load",                "snippet", 10),   // 10 = init snippet
+    OSCWidget("Button A", 12, 13, action_PRESS,       false, false, "/load",                "snippet", 13),   // 13 = lectern on
+    OSCWidget("Button B", 14, 15, action_PRESS,       false, false, "/load",                "snippet", 16),   // 16 = lectern louder
+    OSCWidget("Button C", 27,  2, action_PRESS,       false, false, "/load",                "snippet", 12),   // 12 = band speak
+    OSCWidget("Bttn C__", 27,  2, action_LONG_PRESS,  false, false, "/load",                "snippet", 15),   // 15 = band speak louder
+    OSCWidget("Button D", 26,  0, action_PRESS,       false, false, "/load",                "snippet", 11),   // 11 = band sing
+    OSCWidget("Button E", 25,  4, action_PRESS,       true,  true , DCA_ON(5),              ""),              // DCA 5 = speech
+    OSCWidget("Button F", 33,  5, action_PRESS,       true,  false, MUTE_GROUP(6),          "")};             // Mute Group 6 = all band
+
+// every widget and each console's show address are interned at boot; what is left of paramCache is for what we hear
+static_assert(sizeof(myWidgets) / sizeof(myWidgets[0]) + NUMBER_OF_TARGETS < PARAM_CACHE_SIZE, "PARAM_CACHE_SIZE too small for myWidgets");
+
+//    OSCWidget("Button G", 32, 18, action_NOTHING,     true,  false, "/config/mute/6",       ""),              // Mute Group 6 = all band
+//    OSCWidget("Button H", 35, 23, action_NOTHING,     true,  true , "/dca/5/on",            "")};             // DCA 5 = speech
+
+//    OSCWidget("Example", 35, 23, action_PRESS,       true,  true , "/ch/01/mix/on",        ""),
+//    OSCWidget("Example", 35, 23, action_PRESS,       true,  true , CH_ON(1),               ""),              // the same, on any console family
+//    OSCWidget("Example", 35, 23, action_NOTHING,     true,  true , "/dca/5/on",            ""),
+//    OSCWidget("Example", 35, 23, action_NOTHING,     true,  false, "/config/mute/1",       ""),
+//    OSCWidget("Example", 35, 23, action_LONG_PRESS,  false, false, "/load",                "snippet", 99),
+//    OSCWidget("Example", 35, 23, action_NOTHING,     false, false, "/ch/02/mix/09/level",  "", -1 , 0.75),
+//    OSCWidget("Example", 35, 23, action_PRESS,       true,  false, "/config/mute/2",       "", -1 , -1, 1), // bank 1
+//    OSCWidget("Example", 35, 23, action_PRESS,       true,  true , MAIN_ON,                "", -1 , -1, 0, 1), // XR18 main (target 1)
+//    OSCWidget("Example", 35, 23, action_LONG_PRESS,  bandOff),                                             // macro
+//    OSCWidget("Example", 35, 23, action_PRESS,       false, false, CH_FADER(13),           "", -1 , 0.75, 0, 0, 2000), // 2 s fade
+
+// LOLIN32 Lite
+// GPIO INPUTS 34,35,36,39 do not have internal pull-up/pull-down therefore do not define in myWidgets unless actually needed
+// GPIO 2 is pulled down at start so LED will initially look dimly lit
+#define MIDI_UART 2 // GPIO 16,17
+// UNUSED_GPIO 39                       // unused GPIO pin
+#define PIN_FOR_WIFI_STATUS_LED 22         // internal LED is 22 for my LOLIN32
+#define PIN_FOR_MODE_SWITCH 36             // needs pull-up
+#define PIN_FOR_BATTERY_VOLTAGE 34         // cannot use ADC2 pins (needed for WiFi)
+#define PIN_FOR_BATTERY_STATUS_LED 19      //
+#define BATTERY_LOW_CUTOFF 3034            // 3034 is 20% between 3.10V and 4.16V using divider 68k/(68k+27k)
+#define BATTERY_FULL_CUTOFF 3762           // 3713 = 90%, 3762 = 95%, 3801 = 99%; it only periodically hits 95%
+#define BATTERY_MIN 2840                   // 2840 corresponds to 3.10V in calculations using the above divider
+#define BATTERY_RANGE (3811 - BATTERY_MIN) // 3811 corresponds to 4.16V
+#define ADC_VMAX 3.2                       // apparently 3.2V gives 4095
+#define ADC_DIVIDER 0.715789474            // (68 / (68+27))
+
+// BATTERY THRESHOLDS 0 (0V) - 4095 (3.3V); value depends on voltage divider circuit
+// however apparently 3.2V gives 4095 therefore adjusted table below
+// ---------------- ----- === 0.50 ====   === 0.67 ====   === 0.75 ====
+// battery depleted 3.10V (1.55V, 1984)   (2.08V, 2658)   (2.33V, 2975)
+// battery low 20%  3.31V (1.66V, 2119)   (2.22V, 2840)   (2.48V, 3179)
+// battery full     4.16V (2.08V, 2662)   (2.79V, 3567)   (3.12V, 3993)
+// battery charging 4.26V (2.13V, 2726)   (2.85V, 3652)   (3.20V, 4089)
+
+#if true
+// LED lights up if pin pulls voltage down (sink)
+#define LED_PIN_ON LOW
+#define LED_PIN_OFF HIGH
+#else
+// LED is powered from pin (source)
+#define LED_PIN_ON HIGH
+#define LED_PIN_OFF LOW
+#endif
+
+uint8_t OSCWidget::ledLevel()
+{
+  if (isReverseLed)
+  {
+    return (oscState() > 0) ? LED_PIN_OFF : LED_PIN_ON;
+  }
+  return (oscState() > 0) ? LED_PIN_ON : LED_PIN_OFF;
+}
+
+void OSCWidget::updateLed()
+{
+  doDigitalWrite(ledLevel());
+}
+
+// ******************************************************
+// other variables
+// ******************************************************
+Button modeButton(PIN_FOR_MODE_SWITCH);
+std::atomic<bool> do_xRemote(true);  // two-way: written by taskButtonsLoop, read everywhere
+std::atomic<bool> do_Refresh(true);  // set by anyone, taken (exchange) by pokePoll
+std::atomic<uint8_t> activeBank(0);
+ParamCache paramCache;
+NvsStateStore nvsStateStore(paramCache);
+RefreshEngine refreshEngine;
+uint8_t targetHashIndex[TARGET_HASH_SIZE]; // target index + 1, or 0 if empty; see targetFind
+unsigned long firstCorrectLedMillis = 0; // boot to first LED confirmed by the X32
+unsigned long allCorrectLedMillis = 0;   // boot to no unconfirmed LEDs left
+Transport transport;  // to and from the consoles
+WiFiUDP RelayUdp;     // relay traffic in; out goes through transport
+std::atomic<uint32_t> relayMasterAddress(0); // peers: learnt from the relay broadcasts
+struct RelayWatch
+{
+  paramId_t id;
+  char type;
+};
+MpscQueue<RelayWatch, RELAY_WATCH_QUEUE> relayWatches; // master: from the UDP task to pokePoll, which owns the watch list
+HardwareSerial SerialMIDI(MIDI_UART);
+MIDI_CREATE_INSTANCE(HardwareSerial, SerialMIDI, midiOut); // create a MIDI object called midiOut
+TaskHandle_t xUDPLoopHandle = NULL;      // NULL with USE_REACTOR
+TaskHandle_t xPokeOSCLoopHandle = NULL;
+TaskHandle_t xTxLoopHandle = NULL;
+std::atomic<bool> pokeDue(false);        // reactor: a reply freed a refresh slot
+PollStats buttonsStats;
+PollStats udpStats;
+PollStats pokeStats;
+LatencyStats pressLatency; // button press (at the latest, the poll before it was seen) to packet sent
+LatencyStats ledFeedback;  // toggle press to its LED showing the new state, before the console confirms it
+Coalescer coalescer(coalescedSend); // fader values on their way to the consoles
+LatencyStats macroBuild;   // macro steps resolved, formatted and queued
+std::atomic<uint32_t> faderSent(0);       // see faderSend
+std::atomic<uint32_t> faderSuppressed(0); // the console already had it
+std::atomic<uint32_t> faderQuantised(0);  // moved onto the console's step grid
+MpscQueue<LedCommand, LED_QUEUE_SIZE> ledQueue;
+std::atomic<uint32_t> ledQueueDrops(0); // any task: LED changes lost to a full ledQueue
+struct
+{
+  uint8_t pin;
+  uint8_t level;
+  uint8_t changesLeft;     // blinks still to come, counting on and off
+  uint8_t finalLevel;      // once they are done
+  uint16_t periodMillis;
+  unsigned long dueMillis; // 0 if free
+} ledFlashes[LED_FLASH_MAX]; // owned by ledPoll
+struct
+{
+  paramId_t id;
+  uint16_t durationMs;       // 0 if free
+  unsigned long startMillis;
+  float fromDb;              // the fade is a straight line in dB
+  float toDb;
+  float fromPosition;        // where it started and what we sent last, to tell our own echoes
+  float lastPosition;        // from someone moving the fader on the console
+  float toPosition;
+} ramps[RAMP_SLOTS]; // owned by rampPoll
+LatencyStats rampFrame;    // one frame of every fade in progress
+uint32_t rampsCancelled = 0;
+// expected back: the toggle state, or -1 for /load (any success); previous: the toggle state before the press, to
+// go back to if the console never takes it; tag: paramCache seq when first sent, an update after it may be the
+// acknowledgement
+AckTracker<OSCWidget, ACK_SLOTS, ACK_FIRST_MS, ACK_MAX_MS, ACK_RETRIES> acks; // owned by ackPoll
+LatencyStats ackLatency;   // first send (the press) to acknowledgement, however many resends it took
+struct
+{
+  uint32_t addressHash;      // 0 if free
+  uint32_t hash;             // of the whole message
+  uint8_t target;
+  unsigned long millis;
+} rxRecent[RX_DUPLICATE_SLOTS]; // owned by oscDuplicate
+uint32_t rxDuplicates = 0;
+
+// ***************************************************************
+// ***************************************************************
+// ***************************************************************
+
+// ***************************************************************
+// various minor helper functions
+// ***************************************************************
+
+void printMillis()
+{
+  Serial.print("[");
+  Serial.print(millis());
+  Serial.print("] ");
+}
+
+// ***************************************************************
+// void taskWake
+// - wake a task sleeping in ulTaskNotifyTake; replaces vTaskResume, which is lost
+//   if the task has not suspended itself yet, and vTaskSuspend from outside, which can stop a task anywhere
+// ***************************************************************
+void taskWake(TaskHandle_t handle)
+{
+  if (handle) // NULL with USE_REACTOR
+  {
+    xTaskNotifyGive(handle);
+  }
+}
+
+// ***************************************************************
+// void pressSent
+// - the TX owner has sent a press
+// ***************************************************************
+void pressSent(unsigned long pressMicros)
+{
+  pressLatency.sample(micros() - pressMicros);
+}
+
+// ***************************************************************
+// bool packetQueue
+// bool oscQueue
+// - queue a finished packet for the TX owner; only background traffic waits (briefly) for room
+// - oscQueue formats an OSC message into a packet first; with TX_IDEMPOTENT in txClass it is sent TX_COPIES times
+// - the packet is formatted on the sending task's stack (TX_PACKET_MAX and a few bytes, as in oscSendAll), which
+//   STACK_TASK and STACK_REACTOR allow for; send() copies it into the queue
+// ***************************************************************
+bool packetQueue(const TxPacket &packet, uint8_t txClass)
+{
+  txClass &= ~TX_IDEMPOTENT; // already in packet.copies
+  bool queued = transport.send(packet, txClass);
+  for (int tries = 0; !queued && txClass != TX_CLASS_USER && tries < TX_FULL_RETRIES; tries++)
+  {
+    // e.g. a burst of /subscribe; give the TX owner a chance to catch up
+    if (xTxLoopHandle)
+    {
+      taskWake(xTxLoopHandle);
+      vTaskDelay(1);
+    }
+    else
+    {
+      transport.flush(pressSent); // reactor: we are the TX owner
+    }
+    queued = transport.send(packet, txClass);
+  }
+  if (!queued)
+  {
+    transport.countDropped(txClass);
+  }
+  taskWake(xTxLoopHandle);
+  return queued;
+}
+
+bool oscQueue(IPAddress address, uint16_t port, OSCMessage &msg, uint8_t txClass, unsigned long pressMicros)
+{
+  TxPacket packet;
+  TxPacketWriter writer(packet);
+  packet.address = (uint32_t)address;
+  packet.port = port;
+  packet.pressMicros = pressMicros;
+  packet.copies = (txClass & TX_IDEMPOTENT) ? TX_COPIES - 1 : 0;
+  unsigned long startMicros = micros();
+  msg.send(writer);
+  msg.empty();
+  transport.sampleFormat(micros() - startMicros);
+  if (writer.overflowed())
+  {
+    transport.countTooLong();
+    return false;
+  }
+  return packetQueue(packet, txClass);
+}
+
+// ***************************************************************
+// void oscSend
+// void sendOSC
+// - send an OSC message to one of the consoles
+// - txClass (TX_CLASS_...) says what may go first; presses carry when the press happened, for pressLatency
+// ***************************************************************
+void oscSend(uint8_t target, OSCMessage &msg, uint8_t txClass, unsigned long pressMicros)
+{
+  if (target >= NUMBER_OF_TARGETS)
+  {
+    msg.empty();
+    return;
+  }
+#if RELAY_ROLE == RELAY_PEER && defined(RELAY_COMMANDS_VIA_MASTER)
+  uint32_t master = relayMasterAddress;
+  if (master != 0 && target == 0) // the relay only covers the first console
+  {
+    oscQueue(IPAddress(master), RELAY_PORT, msg, txClass, pressMicros);
+    return;
+  }
+#endif
+  oscQueue(consoleTargets[target].address, consoleTargets[target].port, msg, txClass, pressMicros);
+}
+
+void sendOSC(uint8_t target, OSCMessage &msg, uint8_t txClass)
+{
+  oscSend(target, msg, txClass, 0);
+}
+
+// ***************************************************************
+// void oscSendAll
+// - several messages for one console, packed into as few #bundle datagrams as OSC_BUNDLE_MTU allows,
+//   so they cost one WiFi frame and the console applies them together
+// - one datagram each without OSC_BUNDLES, or through a relay master (it forwards messages one at a time)
+// ***************************************************************
+void oscSendAll(uint8_t target, OSCMessage **msgs, int n, uint8_t txClass, unsigned long pressMicros)
+{
+  bool bundled = OSC_BUNDLES && n > 1 && target < NUMBER_OF_TARGETS;
+#if RELAY_ROLE == RELAY_PEER && defined(RELAY_COMMANDS_VIA_MASTER)
+  bundled &= !(relayMasterAddress != 0 && target == 0);
+#endif
+  if (!bundled)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      oscSend(target, *msgs[i], txClass, (i == 0) ? pressMicros : 0);
+    }
+    return;
+  }
+
+  TxPacket packet;
+  OscBundle bundle(packet);
+  packet.address = (uint32_t)consoleTargets[target].address;
+  packet.port = consoleTargets[target].port;
+  packet.pressMicros = pressMicros;
+  packet.copies = (txClass & TX_IDEMPOTENT) ? TX_COPIES - 1 : 0;
+  unsigned long startMicros = micros();
+  for (int i = 0; i < n; i++)
+  {
+    if (!bundle.add(*msgs[i]) && bundle.size())
+    {
+      // full; send what we have and start the next bundle
+      transport.sampleFormat(micros() - startMicros);
+      packetQueue(packet, txClass);
+      bundle.clear();
+      packet.pressMicros = 0;
+      startMicros = micros();
+      bundle.add(*msgs[i]);
+    }
+    if (!bundle.size())
+    {
+      transport.countTooLong(); // too long even on its own
+    }
+    msgs[i]->empty();
+  }
+  if (bundle.size())
+  {
+    transport.sampleFormat(micros() - startMicros);
+    packetQueue(packet, txClass);
+  }
+}
+
+// ***************************************************************
+// void coalescedSend
+// - a fader value the coalescer has let through
+// ***************************************************************
+void coalescedSend(paramId_t id, float value, unsigned long pressMicros)
+{
+  ParamEntry e;
+  paramCache.get(id, e);
+  OSCMessage msg(e.address);
+  msg.add(value);
+  if (do_xRemote)
+  {
+    // X32 does not seem to echo back fader commands; ask for the value in the same bundle
+    OSCMessage query(e.address);
+    OSCMessage *both[] = {&msg, &query};
+    oscSendAll(e.target, both, 2, TX_CLASS_USER | TX_IDEMPOTENT, pressMicros);
+    return;
+  }
+  oscSend(e.target, msg, TX_CLASS_USER | TX_IDEMPOTENT, pressMicros);
+}
+
+// ***************************************************************
+// bool rampStart
+// void rampCancel
+// void rampPoll
+// - fade a fader from its last known position to a new one, in a straight line in dB (faderLaw)
+// - every RAMP_FRAME_MS, each fade moves to its next step of the console's grid, if it has one: at most one value
+//   per fader per frame, and the faders that move together go in one bundle per console; the last frame
+//   lands exactly on the new position, and asks for it back
+// - a new press, a macro step or a move on the console (an echo off our path) cancels the fade
+// - all in the buttons task (or the reactor); at most RAMP_SLOTS fades, so a frame's work is bounded
+// ***************************************************************
+bool rampStart(paramId_t id, float toPosition, uint16_t durationMs)
+{
+  ParamEntry e;
+  if (!durationMs || !paramCache.get(id, e) || e.type != 'f')
+  {
+    return false; // nowhere known to fade from
+  }
+  uint8_t family = consoleTargets[e.target].family;
+  float from = faderQuantise(e.f, family);
+  float to = faderQuantise(toPosition, family);
+  if (from == to)
+  {
+    return false;
+  }
+  int slot = -1;
+  for (int r = 0; r < RAMP_SLOTS; r++)
+  {
+    if (ramps[r].durationMs && ramps[r].id == id)
+    {
+      slot = r; // a new press takes over the fade in place
+      break;
+    }
+    if (slot < 0 && !ramps[r].durationMs)
+    {
+      slot = r;
+    }
+  }
+  if (slot < 0)
+  {
+    return false;
+  }
+  coalescer.cancel(id); // a value still waiting would land in the middle of the fade
+  ramps[slot].id = id;
+  ramps[slot].durationMs = durationMs;
+  ramps[slot].startMillis = millis();
+  ramps[slot].fromDb = faderToDb(from);
+  ramps[slot].toDb = faderToDb(to);
+  ramps[slot].fromPosition = from;
+  ramps[slot].lastPosition = from;
+  ramps[slot].toPosition = to;
+  return true;
+}
+
+void rampCancel(paramId_t id)
+{
+  for (int r = 0; r < RAMP_SLOTS; r++)
+  {
+    if (ramps[r].durationMs && ramps[r].id == id)
+    {
+      ramps[r].durationMs = 0;
+      rampsCancelled++;
+    }
+  }
+}
+
+void rampPoll()
+{
+  static unsigned long frameMillis = 0;
+  unsigned long now = millis();
+  if (now - frameMillis < RAMP_FRAME_MS)
+  {
+    return; // most passes: before anything is built
+  }
+  frameMillis = now;
+
+  OSCMessage msgs[2 * RAMP_SLOTS];
+  uint8_t msgTarget[2 * RAMP_SLOTS];
+  ParamEntry e;
+  int n = 0;
+  unsigned long startMicros = micros();
+  for (int r = 0; r < RAMP_SLOTS; r++)
+  {
+    if (!ramps[r].durationMs || !paramCache.get(ramps[r].id, e))
+    {
+      continue;
+    }
+    uint8_t family = consoleTargets[e.target].family;
+    float tolerance = (faderSteps[family]) ? 1.0f / (faderSteps[family] - 1) : 0.001f;
+    float low = fminf(ramps[r].fromPosition, ramps[r].lastPosition) - tolerance;
+    float high = fmaxf(ramps[r].fromPosition, ramps[r].lastPosition) + tolerance;
+    if ((e.flags & param_CONFIRMED) && e.type == 'f' && (e.f < low || e.f > high))
+    {
+      ramps[r].durationMs = 0; // moved on the console since our last frame
+      rampsCancelled++;
+      continue;
+    }
+
+    unsigned long elapsed = now - ramps[r].startMillis;
+    bool last = elapsed >= ramps[r].durationMs;
+    float position = ramps[r].toPosition;
+    if (!last)
+    {
+      float db = ramps[r].fromDb + (ramps[r].toDb - ramps[r].fromDb) * elapsed / ramps[r].durationMs;
+      position = faderQuantise(dbToFader(db), family);
+    }
+    if (position != ramps[r].lastPosition || last)
+    {
+      msgs[n].setAddress(e.address);
+      msgs[n].add(position);
+      msgTarget[n++] = e.target;
+      paramCache.setFloat(ramps[r].id, position, false); // assumed until the console confirms
+      ramps[r].lastPosition = position;
+    }
+    if (last)
+    {
+      if (do_xRemote)
+      {
+        msgs[n].setAddress(e.address); // X32 does not seem to echo back fader commands
+        msgTarget[n++] = e.target;
+      }
+      ramps[r].durationMs = 0;
+    }
+  }
+
+  for (uint8_t t = 0; n && t < NUMBER_OF_TARGETS; t++)
+  {
+    OSCMessage *batch[2 * RAMP_SLOTS];
+    int m = 0;
+    for (int i = 0; i < n; i++)
+    {
+      if (msgTarget[i] == t)
+      {
+        batch[m++] = &msgs[i];
+      }
+    }
+    if (m)
+    {
+      oscSendAll(t, batch, m, TX_CLASS_USER, 0);
+    }
+  }
+  if (n)
+  {
+    rampFrame.sample(micros() - startMicros);
+  }
+}
+
+// ***************************************************************
+// bool faderSend
+// - a fader value on its way to a console: quantised to the console's step grid, then not sent at all
+//   if the console has already confirmed that very step; otherwise through the coalescer
+// - returns false if it was not needed
+// ***************************************************************
+bool faderSend(paramId_t id, float position, unsigned long pressMicros)
+{
+  ParamEntry e;
+  if (!paramCache.get(id, e))
+  {
+    return false;
+  }
+  uint8_t family = consoleTargets[e.target].family;
+  float quantised = faderQuantise(position, family);
+  if (quantised != position)
+  {
+    faderQuantised++;
+  }
+  rampCancel(id); // a new press wins over a fade in progress, even one to a step the console already has
+  if (e.type == 'f' && (e.flags & param_CONFIRMED) && faderQuantise(e.f, family) == quantised)
+  {
+    faderSuppressed++;
+    return false;
+  }
+  faderSent++;
+  paramCache.setFloat(id, quantised, false); // assumed until the console confirms
+  coalescer.set(id, quantised, pressMicros);
+  return true;
+}
+
+// ***************************************************************
+// void targetIndexBuild
+// int targetFind
+// - which console did a packet come from? hashed on its source address and port,
+//   so the receive loop finds the session in O(1) however many consoles there are
+// ***************************************************************
+uint8_t targetHash(IPAddress address, uint16_t port)
+{
+  return ((((uint32_t)address * 2654435761u) >> 24) ^ port) & (TARGET_HASH_SIZE - 1);
+}
+
+void targetIndexBuild()
+{
+  memset(targetHashIndex, 0, sizeof(targetHashIndex));
+  for (uint8_t t = 0; t < NUMBER_OF_TARGETS; t++)
+  {
+    consoleTargets[t].begin(t);
+    uint8_t slot = targetHash(consoleTargets[t].address, consoleTargets[t].port);
+    while (targetHashIndex[slot])
+    {
+      slot = (slot + 1) & (TARGET_HASH_SIZE - 1);
+    }
+    targetHashIndex[slot] = t + 1;
+  }
+}
+
+// returns the index into consoleTargets, or -1 if the packet is not from one of our consoles
+int targetFind(IPAddress address, uint16_t port)
+{
+  uint8_t slot = targetHash(address, port);
+  while (targetHashIndex[slot])
+  {
+    ConsoleTarget &target = consoleTargets[targetHashIndex[slot] - 1];
+    if (target.address == address && target.port == port)
+    {
+      return target.index;
+    }
+    slot = (slot + 1) & (TARGET_HASH_SIZE - 1);
+  }
+  return -1;
+}
+
+// ***************************************************************
+// void midiBuildCommand
+// - construct a MIDI SysEx from the OSC command
+// ***************************************************************
+void midiBuildCommand(char* oscCommand, char* oscArgument)
+{
+  // update global variable: bigMidiCommand
+  // no error checking to ensure that bigMidiCommand does not exceed 64 char
+  bigMidiCommand[0] = 0;
+  strcat(bigMidiCommand,midiHeader);
+  strcat(bigMidiCommand,oscCommand);
+  strcat(bigMidiCommand,midiSpacer);
+  strcat(bigMidiCommand,oscArgument);
+  strcat(bigMidiCommand,midiFooter);
+
+  // DEBUG print the HEX string generated
+#ifdef VERBOSE_DEBUG
+  Serial.print("MIDI Message in HEX: ");
+  for (int j = 0; j < strlen(bigMidiCommand); j++)
   {
     if (bigMidiCommand[j] < 0x10)
     {
@@ -271,6 +3456,43 @@ void midiBuildCommand(char* oscCommand, char* oscArgument)
 #endif
 }
 
+// ***************************************************************
+// paramId_t paramCacheUpdate
+// - record a message received from a console in paramCache
+// - returns the id of its address, or PARAM_NONE if the cache is full
+// ***************************************************************
+paramId_t paramCacheUpdate(uint8_t target, OSCMessage &msg)
+{
+  char address[PARAM_ADDRESS_LEN];
+  char str[PARAM_STRING_LEN];
+
+  msg.getAddress(address, 0, PARAM_ADDRESS_LEN); // strncpy: not terminated if too long
+  if (address[PARAM_ADDRESS_LEN - 1])
+  {
+    return PARAM_NONE;
+  }
+  paramId_t id = paramCache.intern(address, target);
+  if (id == PARAM_NONE)
+  {
+    return PARAM_NONE;
+  }
+
+  if (msg.isInt(0))
+  {
+    paramCache.setInt(id, msg.getInt(0), true);
+  }
+  else if (msg.isFloat(0))
+  {
+    paramCache.setFloat(id, msg.getFloat(0), true);
+  }
+  else if (msg.isString(0))
+  {
+    msg.getString(0, str, PARAM_STRING_LEN);
+    paramCache.setString(id, str, (msg.isInt(1)) ? msg.getInt(1) : -1, true);
+  }
+  return id;
+}
+
 // ***************************************************************
 // WiFiStationConnected
 // WiFiGotIP
@@ -285,469 +3507,1649 @@ void WiFiStationConnected(WiFiEvent_t event, WiFiEventInfo_t info)
   Serial.println("Connected to AP");
 }
 
-void WiFiGotIP(WiFiEvent_t event, WiFiEventInfo_t info)
+void WiFiGotIP(WiFiEvent_t event, WiFiEventInfo_t info)
+{
+  printMillis();
+  Serial.print("Obtained local IP address: ");
+  Serial.println(WiFi.localIP());
+  printMillis();
+  Serial.print("transport.begin(");
+  Serial.print(localPort);
+  Serial.println(") and waking taskUDPLoop");
+
+  if (!transport.begin(localPort))
+  {
+    printMillis();
+    Serial.println("could not open the OSC socket");
+  }
+#if RELAY_ROLE != RELAY_NONE
+  RelayUdp.begin(RELAY_PORT);
+#endif
+  taskWake(xUDPLoopHandle);
+  taskWake(xPokeOSCLoopHandle);
+}
+
+void WiFiStationDisconnected(WiFiEvent_t event, WiFiEventInfo_t info)
+{
+  // taskUDPLoop sees WiFi.status() and goes to sleep by itself, between packets
+  printMillis();
+  Serial.print("WiFi disconnected. Reason: ");
+  Serial.print(info.wifi_sta_disconnected.reason);
+  Serial.println(".");
+  printMillis();
+  Serial.println("Trying to reconnect WiFi...");
+
+  WiFi.begin(ssid, pass);
+}
+
+const char *wl_status_to_string(wl_status_t status)
+{
+  switch (status)
+  {
+  case WL_NO_SHIELD:
+    return "WL_NO_SHIELD";
+  case WL_IDLE_STATUS:
+    return "WL_IDLE_STATUS";
+  case WL_NO_SSID_AVAIL:
+    return "WL_NO_SSID_AVAIL";
+  case WL_SCAN_COMPLETED:
+    return "WL_SCAN_COMPLETED";
+  case WL_CONNECTED:
+    return "WL_CONNECTED";
+  case WL_CONNECT_FAILED:
+    return "WL_CONNECT_FAILED";
+  case WL_CONNECTION_LOST:
+    return "WL_CONNECTION_LOST";
+  case WL_DISCONNECTED:
+    return "WL_DISCONNECTED";
+  }
+}
+
+// ***************************************************************
+// void taskStart
+// - create a task with a stack of stackBytes, as the scheduling plan says, or as before if there is no plan
+// ***************************************************************
+void taskStart(TaskFunction_t function, const char *name, uint32_t stackBytes, void *parameters, UBaseType_t priority, BaseType_t core, TaskHandle_t *handle)
+{
+#if SCHEDULE_PLAN
+  xTaskCreatePinnedToCore(function, name, stackBytes, parameters, priority, handle, core);
+#else
+  xTaskCreate(function, name, stackBytes, parameters, 1, handle);
+#endif
+}
+
+// ***************************************************************
+// void taskCpuPrint
+// - CPU share of every task since the last call, as a percentage of one core
+// - needs run time stats in the FreeRTOS configuration, which stock arduino-esp32 leaves out: sdkconfig
+//   CONFIG_FREERTOS_USE_TRACE_FACILITY=y and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS=y (Arduino as an ESP-IDF
+//   component, or a rebuilt core); without them, the poll gaps (PollStats) are all there is to compare
+// ***************************************************************
+void taskCpuPrint()
+{
+#if configUSE_TRACE_FACILITY == 1 && configGENERATE_RUN_TIME_STATS == 1
+  static TaskStatus_t status[TASK_STATS_MAX];
+  static struct
+  {
+    TaskHandle_t handle;
+    uint32_t runTime;
+  } previous[TASK_STATS_MAX];
+  static UBaseType_t previousCount = 0;
+  static uint32_t previousTotal = 0;
+  uint32_t total;
+
+  UBaseType_t n = uxTaskGetSystemState(status, TASK_STATS_MAX, &total);
+  uint32_t elapsed = total - previousTotal;
+  if (n == 0 || elapsed == 0)
+  {
+    return; // more tasks than TASK_STATS_MAX
+  }
+  printMillis();
+  Serial.print("CPU %:");
+  for (UBaseType_t t = 0; t < n; t++)
+  {
+    uint32_t before = 0;
+    for (UBaseType_t p = 0; p < previousCount; p++)
+    {
+      if (previous[p].handle == status[t].xHandle)
+      {
+        before = previous[p].runTime;
+        break;
+      }
+    }
+    Serial.print(" ");
+    Serial.print(status[t].pcTaskName);
+    Serial.print("/");
+    Serial.print(status[t].uxCurrentPriority);
+    Serial.print(" ");
+    Serial.print((float)(status[t].ulRunTimeCounter - before) * 100 / elapsed, 1);
+  }
+  Serial.println();
+  for (UBaseType_t t = 0; t < n; t++)
+  {
+    previous[t].handle = status[t].xHandle;
+    previous[t].runTime = status[t].ulRunTimeCounter;
+  }
+  previousCount = n;
+  previousTotal = total;
+#else
+  printMillis();
+  Serial.println("CPU %: no run time stats in this build (see taskCpuPrint); compare the poll gaps instead");
+#endif
+}
+
+// ***************************************************************
+// void ledWrite
+// void ledFlash
+// void ledError
+// void ledPoll
+// - any task may ask for an LED change; only ledPoll (taskButtonsLoop, or the reactor) touches the pins,
+//   in the order the changes were asked for
+// ***************************************************************
+void ledQueuePush(uint8_t pin, uint8_t level, uint16_t flashMillis, uint8_t blinks = 0)
+{
+  LedCommand command;
+  command.pin = pin;
+  command.level = level;
+  command.flashMillis = flashMillis;
+  command.blinks = blinks;
+  if (!ledQueue.push(command))
+  {
+    ledQueueDrops++; // only cosmetic, and the next update will put it right
+  }
+}
+
+void ledWrite(uint8_t pin, uint8_t level)
+{
+  ledQueuePush(pin, level, 0);
+}
+
+void OSCWidget::doDigitalWrite(uint8_t val)
+{
+  ledWrite(ledPin, val);
+}
+
+void ledFlash(uint8_t ledPin)
+{
+  ledQueuePush(ledPin, LED_PIN_ON, (do_xRemote) ? 200 : 100);
+}
+
+// a quick burst of blinks, different from a flash or the slow stale blink, then finalLevel
+void ledError(uint8_t ledPin, uint8_t finalLevel)
+{
+  ledQueuePush(ledPin, finalLevel, LED_ERROR_MS, LED_ERROR_BLINKS);
+}
+
+void ledPoll()
+{
+  LedCommand command;
+  unsigned long now = millis();
+  while (ledQueue.pop(command))
+  {
+    uint8_t level = (command.blinks) ? LED_PIN_ON : command.level;
+    digitalWrite(command.pin, level);
+    int slot = -1;
+    for (int f = 0; f < LED_FLASH_MAX; f++)
+    {
+      if (ledFlashes[f].dueMillis && ledFlashes[f].pin == command.pin)
+      {
+        ledFlashes[f].dueMillis = 0; // a newer command wins
+      }
+      if (!ledFlashes[f].dueMillis && slot < 0)
+      {
+        slot = f;
+      }
+    }
+    if (command.flashMillis && slot >= 0)
+    {
+      ledFlashes[slot].pin = command.pin;
+      ledFlashes[slot].level = level;
+      ledFlashes[slot].changesLeft = (command.blinks) ? command.blinks * 2 - 1 : 0;
+      ledFlashes[slot].finalLevel = (command.blinks) ? command.level : LED_PIN_OFF;
+      ledFlashes[slot].periodMillis = command.flashMillis;
+      ledFlashes[slot].dueMillis = (now + command.flashMillis) | 1; // never 0
+    }
+  }
+  for (auto &flash : ledFlashes)
+  {
+    if (!flash.dueMillis || (long)(now - flash.dueMillis) < 0)
+    {
+      continue;
+    }
+    if (flash.changesLeft)
+    {
+      flash.changesLeft--;
+      flash.level = (flash.level == LED_PIN_ON) ? LED_PIN_OFF : LED_PIN_ON;
+      digitalWrite(flash.pin, flash.level);
+      flash.dueMillis = (now + flash.periodMillis) | 1;
+    }
+    else
+    {
+      digitalWrite(flash.pin, flash.finalLevel);
+      flash.dueMillis = 0;
+    }
+  }
+}
+
+// ***************************************************************
+// void pokeNotify
+// - wake pokePoll early, e.g. a reply has freed a refresh slot
+// ***************************************************************
+void pokeNotify()
+{
+  if (xPokeOSCLoopHandle)
+  {
+    xTaskNotifyGive(xPokeOSCLoopHandle);
+  }
+  else
+  {
+    pokeDue = true;
+  }
+}
+
+// ***************************************************************
+// void bankSelect
+// - make another bank of widgets active
+// - LEDs are painted straight from paramCache (no network round trip)
+// - only addresses the X32 has not told us about yet are queued for refresh
+// ***************************************************************
+void bankSelect(uint8_t newBank)
+{
+  unsigned long startMicros = micros();
+  int queries = 0;
+
+  activeBank = newBank;
+  for (auto &theWidget : myWidgets)
+  {
+    if (!theWidget.isActive())
+    {
+      continue;
+    }
+    if (theWidget.isOscToggle)
+    {
+      theWidget.updateLed();
+      if (do_xRemote && !paramCache.isConfirmed(theWidget.paramId))
+      {
+        refreshEngine.request(theWidget.paramId); // sent by taskPokeOSCLoop
+        queries++;
+      }
+    }
+    else
+    {
+      theWidget.doDigitalWrite(LED_PIN_OFF);
+    }
+  }
+
+  unsigned long elapsedMicros = micros() - startMicros;
+  printMillis();
+  Serial.print("bank ");
+  Serial.print(activeBank.load());
+  Serial.print(" selected in ");
+  Serial.print(elapsedMicros);
+  Serial.print(" us, queued ");
+  Serial.println(queries);
+}
+
+// ***************************************************************
+// bool showChangeCheck
+// - does this message from the X32 mean many parameters may have changed at once?
+// - if so invalidate the affected entries in paramCache and resync the watched ones,
+//   with the widgets visible in the current bank first
+// ***************************************************************
+struct ShowEvent
+{
+  const char *address;
+  const char *string; // first argument must match, or NULL for any change of value
+};
+
+const ShowEvent showEvents[] = {
+    {"/load", "snippet"},           // X32 replies /load,si snippet 1 (0 if no such snippet)
+    {"/load", "scene"},
+    {"/-show/prepos/current", NULL}, // current scene/snippet/cue changed
+    {"/-action/goscene", NULL},
+    {"/-action/gosnippet", NULL},
+    {"/-snap/index", NULL},          // X-Air snapshot loaded
+    {"/-show/showfile/show/name", NULL}};
+
+// parameters that a scene or snippet can change; /-show, /-stat, /info, /load etc. are not affected
+const char *const showScopedPrefixes[] = {
+    "/ch/", "/auxin/", "/fxrtn/", "/bus/", "/mtx/", "/main/", "/dca/", "/config/mute/", "/headamp/", "/lr/", "/rtn/"};
+
+std::atomic<unsigned long> snippetPressMillis(0); // when we last sent /load ourselves
+std::atomic<unsigned long> showChangeMillis(0);   // when the current show change started; 0 if none
+
+bool showChangeCheck(paramId_t id)
+{
+  ParamEntry e;
+  if (!paramCache.get(id, e))
+  {
+    return false;
+  }
+  // values last seen on each console for the events without a string, as subscriptions resend unchanged values
+  static uint32_t lastSeen[TARGETS_MAX][sizeof(showEvents) / sizeof(showEvents[0])];
+  static bool seen[TARGETS_MAX][sizeof(showEvents) / sizeof(showEvents[0])];
+
+  bool isShowChange = false;
+  for (int k = 0; k < (int)(sizeof(showEvents) / sizeof(showEvents[0])); k++)
+  {
+    if (strcmp(e.address, showEvents[k].address) != 0)
+    {
+      continue;
+    }
+    if (showEvents[k].string)
+    {
+      if (e.type == 's' && strcmp(e.s, showEvents[k].string) == 0)
+      {
+        isShowChange = (e.i != 0); // index 0 means nothing was loaded
+        break;
+      }
+    }
+    else
+    {
+      uint32_t value = (e.type == 's') ? ParamCache::hash(e.s) : (uint32_t)e.i;
+      isShowChange = seen[e.target][k] && lastSeen[e.target][k] != value; // the first value we hear is not a change
+      seen[e.target][k] = true;
+      lastSeen[e.target][k] = value;
+      break;
+    }
+  }
+  if (!isShowChange)
+  {
+    return false;
+  }
+
+  unsigned long now = millis();
+  uint64_t invalidated = paramCache.invalidate(e.target, showScopedPrefixes, sizeof(showScopedPrefixes) / sizeof(showScopedPrefixes[0]));
+  int resync = 0;
+  for (auto &theWidget : myWidgets)
+  {
+    if (theWidget.paramId < PARAM_CACHE_SIZE && (invalidated & (1ULL << theWidget.paramId)))
+    {
+      refreshEngine.request(theWidget.paramId, theWidget.isActive());
+      resync++;
+    }
+  }
+  // measure from our own snippet press if that is what caused it
+  unsigned long pressMillis = snippetPressMillis.exchange(0);
+  showChangeMillis = (pressMillis && (now - pressMillis) < 2000) ? pressMillis : now;
+
+  printMillis();
+  Serial.print("show change: ");
+  Serial.print(consoleTargets[e.target].name);
+  Serial.print(" ");
+  Serial.print(e.address);
+  Serial.print(", invalidated ");
+  Serial.print(__builtin_popcountll(invalidated));
+  Serial.print(", resyncing ");
+  Serial.println(resync);
+  return true;
+}
+
+// ***************************************************************
+// bool ackable
+// void ackSend
+// void ackTrack
+// void ackFail
+// void ackPoll
+// - UDP loses packets: toggles and /load are resent until the console acknowledges them, i.e. paramCache
+//   gets a confirmed update after the send, with the value we sent (the echo, or the reply to the query
+//   that goes with a toggle); for /load, the X32 replies /load,si snippet 1 (it does not say which), or 0 if
+//   it has no such snippet, which is a failure there is no point retrying: as every /load widget shares the
+//   one /load entry, only the latest /load per console is awaited, so a reply is never taken for another's;
+//   resends back off exponentially
+//   (ACK_FIRST_MS doubling up to ACK_MAX_MS), ACK_RETRIES at most, as AckTracker (src/AckTracker.h) times them
+// - resending the value (not another flip) is harmless if only the acknowledgement was lost
+// - a new press of the same widget replaces its command in place; only in two-way mode
+// - a toggle's LED shows the new state at the press, pending until acknowledged (param_PENDING: meanwhile other
+//   values from the console, e.g. a subscription resend sent before our command arrived, are ignored); if the
+//   console never takes it, the toggle goes back to its state before the press, the LED blinks the error pattern
+//   and the console is asked for the real state
+// - all in the buttons task (or the reactor)
+// ***************************************************************
+bool ackable(OSCWidget &theWidget)
+{
+  // X32 replies /load,si snippet N; other non-toggles are not known to be echoed
+  return theWidget.paramId != PARAM_NONE && (theWidget.isOscToggle || (theWidget.oscPayload_f < 0 && !strcmp(theWidget.oscAddress, "/load")));
+}
+
+void ackSend(OSCWidget &theWidget, int32_t value)
+{
+  OSCMessage msg(theWidget.oscAddress);
+  if (theWidget.isOscToggle)
+  {
+    msg.add(value);
+    OSCMessage query(theWidget.oscAddress); // X32 does not seem to echo back mutes
+    OSCMessage *both[] = {&msg, &query};
+    oscSendAll(theWidget.target, both, 2, TX_CLASS_USER | TX_IDEMPOTENT, 0);
+    return;
+  }
+  if (*theWidget.oscPayload_s)
+  {
+    msg.add(theWidget.oscPayload_s);
+  }
+  if (theWidget.oscPayload_i >= 0)
+  {
+    msg.add(theWidget.oscPayload_i);
+  }
+  oscSend(theWidget.target, msg, TX_CLASS_USER, 0);
+}
+
+// theWidget has just sent value (toggle state, or -1 for /load); previous is the toggle state it replaced
+void ackTrack(OSCWidget &theWidget, int32_t value, int32_t previous)
 {
-  printMillis();
-  Serial.print("Obtained local IP address: ");
-  Serial.println(WiFi.localIP());
-  printMillis();
-  Serial.print("Udp.begin(");
-  Serial.print(localPort);
-  Serial.println(") and Resuming taskUDPLoop");
-
-  Udp.begin(localPort);
-  vTaskResume(xUDPLoopHandle);
-  vTaskResume(xPokeOSCLoopHandle);
+  ParamEntry e;
+  if (!do_xRemote || !ackable(theWidget) || !paramCache.get(theWidget.paramId, e))
+  {
+    return;
+  }
+  for (int a = 0; !theWidget.isOscToggle && a < ACK_SLOTS; a++)
+  {
+    OSCWidget *other = acks.command(a).sender;
+    if (other && other != &theWidget && other->paramId == theWidget.paramId)
+    {
+      printMillis();
+      Serial.print(other->friendlyDebugName);
+      Serial.print(": no longer awaited, ");
+      Serial.print(theWidget.friendlyDebugName);
+      Serial.println(" would take its reply");
+      acks.forget(a);
+    }
+  }
+  if (acks.track(&theWidget, value, previous, e.seq, millis()) && theWidget.isOscToggle)
+  {
+    paramCache.setPending(theWidget.paramId, true);
+  }
 }
 
-void WiFiStationDisconnected(WiFiEvent_t event, WiFiEventInfo_t info)
+void ackFail(int a)
 {
-  vTaskSuspend(xUDPLoopHandle);
-
-  printMillis();
-  Serial.print("WiFi disconnected. Reason: ");
-  Serial.print(info.wifi_sta_disconnected.reason);
-  Serial.println(". Suspended taskUDPLoop.");
-  printMillis();
-  Serial.println("Trying to reconnect WiFi...");
-
-  WiFi.begin(ssid, pass);
+  OSCWidget &theWidget = *acks.command(a).sender;
+  int32_t previous = acks.command(a).previous;
+  acks.fail(a);
+  paramCache.setPending(theWidget.paramId, false);
+  if (theWidget.isOscToggle && !paramCache.isConfirmed(theWidget.paramId))
+  {
+    paramCache.setInt(theWidget.paramId, previous, false); // roll back what we assumed at the press
+  }
+  ledError(theWidget.ledPin, (theWidget.isOscToggle) ? theWidget.ledLevel() : LED_PIN_OFF);
+  if (theWidget.isOscToggle)
+  {
+    refreshEngine.request(theWidget.paramId, true); // a bare /load query would tell us nothing
+  }
 }
 
-const char *wl_status_to_string(wl_status_t status)
+void ackPoll()
 {
-  switch (status)
+  ParamEntry e;
+  for (int a = 0; a < ACK_SLOTS; a++)
   {
-  case WL_NO_SHIELD:
-    return "WL_NO_SHIELD";
-  case WL_IDLE_STATUS:
-    return "WL_IDLE_STATUS";
-  case WL_NO_SSID_AVAIL:
-    return "WL_NO_SSID_AVAIL";
-  case WL_SCAN_COMPLETED:
-    return "WL_SCAN_COMPLETED";
-  case WL_CONNECTED:
-    return "WL_CONNECTED";
-  case WL_CONNECT_FAILED:
-    return "WL_CONNECT_FAILED";
-  case WL_CONNECTION_LOST:
-    return "WL_CONNECTION_LOST";
-  case WL_DISCONNECTED:
-    return "WL_DISCONNECTED";
+    auto &command = acks.command(a);
+    if (!command.sender || !paramCache.get(command.sender->paramId, e))
+    {
+      continue;
+    }
+    OSCWidget &theWidget = *command.sender;
+    if ((e.flags & param_CONFIRMED) && e.seq != command.tag)
+    {
+      bool isToggle = theWidget.isOscToggle;
+      bool isReply = !isToggle && e.type == 's' && (!*theWidget.oscPayload_s || !strcmp(e.s, theWidget.oscPayload_s));
+      if (isToggle ? (e.type == 'i' && e.i == command.value) : (isReply && e.i != 0))
+      {
+        ackLatency.sample(acks.acknowledge(a, e.updatedMillis) * 1000UL);
+        paramCache.setPending(theWidget.paramId, false);
+        continue;
+      }
+      if (isReply && e.i == 0)
+      {
+        printMillis();
+        Serial.print(theWidget.friendlyDebugName);
+        Serial.println(": the console has no such snippet");
+        ackFail(a);
+        continue;
+      }
+    }
+    switch (acks.due(a, millis()))
+    {
+    case acks.ACK_GIVE_UP:
+      printMillis();
+      Serial.print(theWidget.friendlyDebugName);
+      Serial.println(": not acknowledged, given up");
+      ackFail(a);
+      break;
+    case acks.ACK_RESEND:
+      ackSend(theWidget, command.value);
+      break;
+    default:
+      break;
+    }
   }
 }
 
 // ***************************************************************
-// void taskLedFlash
-// - multiple instances of this task can be started
-//
-// call with:-
-// xTaskCreate(taskLedFlash, "taskLedFlash", 10000, (void*)22, 1, NULL);
-// xTaskCreate(taskLedFlash, "taskLedFlash", 10000, (void*)(uint32_t)theWidget.ledPin, 1, NULL);
+// void macroRun
+// void macroPoll
+// - run a macro widget's steps from macroNext up to the next delayed one: resolved for the console family,
+//   formatted together and handed to the transport as few bundles as they fit in; macroPoll runs the rest when due
+// - steps the console family has no address for are skipped
+// - parameters we mirror are assumed set until the console confirms, and asked for in the same bundle
 // ***************************************************************
-void taskLedFlash(void *parameters)
+void macroRun(OSCWidget &theWidget, unsigned long pressMicros)
 {
-  uint8_t ledPin = (uint32_t)parameters;
-  // if want to read state it may need different mode GPIO_MODE_INPUT_OUTPUT / GPIO_MODE_INPUT_PUTPUT_OD
+  ConsoleTarget &console = consoleTargets[theWidget.target];
+  OSCMessage msgs[MACRO_BATCH_MAX];
+  OSCMessage *batch[MACRO_BATCH_MAX];
+  char address[PARAM_ADDRESS_LEN];
+  bool inverted;
+  int n = 0;
+  unsigned long startMicros = micros();
+  uint8_t s = theWidget.macroNext;
+  do
+  {
+    const MacroStep &step = theWidget.macro[s++];
+    if (!schemaResolve(step.param, console.family, address, PARAM_ADDRESS_LEN, inverted))
+    {
+      continue;
+    }
+    paramId_t id = paramCache.find(address, theWidget.target);
+    msgs[n].setAddress(address);
+    if (step.type == 'f')
+    {
+      float value = faderQuantise(step.value, console.family);
+      msgs[n].add(value);
+      rampCancel(id);
+      paramCache.setFloat(id, value, false); // nothing happens if we do not mirror it
+    }
+    else
+    {
+      int32_t value = (inverted) ? (step.value == 0) : (int32_t)step.value; // steps are written for the X32 encoding
+      msgs[n].add(value);
+      paramCache.setInt(id, value, false);
+    }
+    batch[n] = &msgs[n];
+    n++;
+    if (id != PARAM_NONE && do_xRemote)
+    {
+      msgs[n].setAddress(address); // X32 does not seem to echo it back
+      batch[n] = &msgs[n];
+      n++;
+    }
+  } while (s < theWidget.macroLength && theWidget.macro[s].delayMs == 0 && n + 2 <= MACRO_BATCH_MAX);
 
-#ifdef VERBOSE_DEBUG
-  printMillis();
-  Serial.print("Flashing pin: ");
-  Serial.println(ledPin);
-#endif
-  digitalWrite(ledPin, LED_PIN_ON);
-  vTaskDelay(((do_xRemote)?200:100) / portTICK_PERIOD_MS);
-  digitalWrite(ledPin, LED_PIN_OFF);
-  // delete myself on completion
-  vTaskDelete(NULL);   
+  if (n)
+  {
+    oscSendAll(theWidget.target, batch, n, TX_CLASS_USER | TX_IDEMPOTENT, pressMicros); // on, off and levels
+  }
+  macroBuild.sample(micros() - startMicros);
+  theWidget.macroNext = s;
+  if (s < theWidget.macroLength)
+  {
+    theWidget.macroDueMillis = millis() + theWidget.macro[s].delayMs;
+  }
+}
+
+void macroPoll()
+{
+  for (auto &theWidget : myWidgets)
+  {
+    if (theWidget.macroNext < theWidget.macroLength && (long)(millis() - theWidget.macroDueMillis) >= 0)
+    {
+      macroRun(theWidget, 0);
+    }
+  }
 }
 
 // ***************************************************************
+// void buttonsPoll
 // void taskButtonsLoop
 // - respond to button presses by sending OSC instruction
-// - (modeButton is handled elsewhere)
+// - modeButton selects one-way/two-way, or flicked away and back, the next bank
 // ***************************************************************
-void taskButtonsLoop(void *parameters)
+void buttonsPoll()
 {
   char stringNumber[4];
   int action = action_NOTHING;
   int how_long_is_long;
+  static bool modeReleased = do_xRemote;  // settled position of modeButton
+  static bool modePending = false;        // modeButton has moved but not settled yet
+  static unsigned long modeToggledMillis = 0;
+  static unsigned long previousPollMicros = 0;
+  unsigned long pressedAfterMicros = previousPollMicros; // a press seen in this poll happened after this
+  previousPollMicros = micros();
 
-  for (;;)
+  buttonsStats.tick();
+  // poll the service button(s)
+  if (modeButton.toggled())
+  {
+    if (modePending && (modeButton.read() == Button::RELEASED) == modeReleased)
+    {
+      // back where it was within BANK_GESTURE_DURATION, so this is a bank gesture not a mode change
+      modePending = false;
+      bankSelect((activeBank + 1) % NUMBER_OF_BANKS);
+    }
+    else
+    {
+      modePending = true;
+      modeToggledMillis = millis();
+    }
+  };
+  if (modePending && (millis() - modeToggledMillis) > BANK_GESTURE_DURATION)
   {
-    // poll the service button(s)
-    if (modeButton.toggled())
+    modePending = false;
+    modeReleased = (modeButton.read() == Button::RELEASED);
+    do_xRemote = modeReleased;
+    if (do_xRemote) {
+      do_Refresh = true;
+      taskWake(xUDPLoopHandle);
+    }
+    printMillis();
+    Serial.print("do_xRemote: ");
+    Serial.println(do_xRemote.load(), HEX);
+  };
+  // poll the OSC button(s)
+  for (auto &theWidget : myWidgets)
+  {
+    // how was the button pressed?
+    how_long_is_long = (theWidget.actionTrigger == action_LONG_PRESS) ? LONG_PRESS_DURATION : VERY_LONG_PRESS_DURATION;
+    if (theWidget.button.toggled())
     {
-      do_xRemote = (modeButton.read() == Button::RELEASED);
-      if (do_xRemote) {
-        do_Refresh = true;
-        vTaskResume(xUDPLoopHandle);
+      if (theWidget.button.read() == Button::PRESSED) {
+        theWidget.pressedMillis = millis();
+        theWidget.wasPressed = true;
+        action = action_PRESS;
+      } else
+      {
+        theWidget.wasPressed = false;
+        action = action_NOTHING;
       }
+    }
+    else if (theWidget.wasPressed && ((millis() - theWidget.pressedMillis) > how_long_is_long)) 
+    {
+      theWidget.wasPressed = false;
+      action = theWidget.actionTrigger & mask_LONG_PRESS; // either action_LONG_PRESS or action_VLONG_PRESS
+    }
+    else
+    {
+      action = action_NOTHING;
+    }
+
+#ifdef VERBOSE_DEBUG      
+    if (action != action_NOTHING) {
       printMillis();
-      Serial.print("do_xRemote: ");
-      Serial.println(do_xRemote, HEX);
-    };
-    // poll the OSC button(s)
-    for (auto &theWidget : myWidgets)
+      Serial.print("button press action: ");
+      Serial.println(action);
+    }
+#endif
+
+    if (action == theWidget.actionTrigger && action != action_NOTHING && theWidget.isActive() && theWidget.macro)
+    {
+      // (re)start the macro from its first step; at once, unless that has a delay
+      theWidget.macroNext = 0;
+      theWidget.macroDueMillis = millis() + theWidget.macro[0].delayMs;
+      if (!theWidget.macro[0].delayMs)
+      {
+        macroRun(theWidget, (action == action_PRESS) ? pressedAfterMicros : 0);
+      }
+      printMillis();
+      theWidget.print();
+    }
+    else if (action == theWidget.actionTrigger && action != action_NOTHING && theWidget.isActive())
     {
-      // how was the button pressed?
-      how_long_is_long = (theWidget.actionTrigger == action_LONG_PRESS) ? LONG_PRESS_DURATION : VERY_LONG_PRESS_DURATION;
-      if (theWidget.button.toggled())
+      // compose the OSC message
+      OSCMessage msg(theWidget.oscAddress);
+      char *midiPayload = theWidget.oscPayload_s;
+      int oldState = theWidget.oscState();
+      if (theWidget.isOscToggle)
+      {
+        int newState = (oldState < 1) ? 1 : 0;                  // flip the last known X32 state
+        paramCache.setInt(theWidget.paramId, newState, false);  // assumed until the X32 confirms
+        midiPayload = (newState < 1) ? stringOFF : stringON;    // compose text for MIDI SysEx
+        msg.add(newState);
+      }
+      else
+      {
+        if (theWidget.oscPayload_f >= 0)
+        {
+          // assume fader-type OSC
+          msg.add(theWidget.oscPayload_f);
+          // convert float to string to compose text for MIDI SysEx; does MIDI SysEx method accept float?
+          itoa((int)((theWidget.oscPayload_f*127) + 0.5),stringNumber,10);
+          midiPayload = stringNumber;
+        }
+        else
+        {
+          // assume snippet-type OSC
+          snippetPressMillis = millis();
+          if (*theWidget.oscPayload_s)
+          {
+            msg.add(theWidget.oscPayload_s); // send the payload string if defined
+          };
+          if (theWidget.oscPayload_i >= 0)
+          {
+            msg.add(theWidget.oscPayload_i); // send the payload int (index) if defined
+          }
+        }
+      };
+
+      // send OSC message, ahead of anything else queued; fader values through faderSend
+      unsigned long pressMicros = (action == action_PRESS) ? pressedAfterMicros : 0;
+      if (theWidget.oscPayload_f >= 0 && !theWidget.isOscToggle && theWidget.paramId != PARAM_NONE)
       {
-        if (theWidget.button.read() == Button::PRESSED) {
-          theWidget.pressedMillis = millis();
-          theWidget.wasPressed = true;
-          action = action_PRESS;
-        } else
+        msg.empty();
+        if (!rampStart(theWidget.paramId, theWidget.oscPayload_f, theWidget.fadeMs))
         {
-          theWidget.wasPressed = false;
-          action = action_NOTHING;
+          faderSend(theWidget.paramId, theWidget.oscPayload_f, pressMicros); // asks for the value back itself
         }
       }
-      else if (theWidget.wasPressed && ((millis() - theWidget.pressedMillis) > how_long_is_long)) 
+      else if (do_xRemote && (theWidget.isOscToggle || theWidget.oscPayload_f >= 0))
       {
-        theWidget.wasPressed = false;
-        action = theWidget.actionTrigger & mask_LONG_PRESS; // either action_LONG_PRESS or action_VLONG_PRESS
+        // X32 does not seem to echo back the Fader and Mute commands or Mute Group. Or at least the X32 Emulator...
+        // so ask for the value in the same bundle, to get an update
+        OSCMessage msg2(theWidget.oscAddress);
+        OSCMessage *both[] = {&msg, &msg2};
+        oscSendAll(theWidget.target, both, 2, TX_CLASS_USER | TX_IDEMPOTENT, pressMicros);
       }
       else
       {
-        action = action_NOTHING;
+        // a toggle sends the new state, not a flip; a snippet is recalled only once
+        oscSend(theWidget.target, msg, TX_CLASS_USER | ((theWidget.isOscToggle || theWidget.oscPayload_f >= 0) ? TX_IDEMPOTENT : 0), pressMicros);
       }
+      ackTrack(theWidget, (theWidget.isOscToggle) ? theWidget.oscState() : -1, oldState);
 
-#ifdef VERBOSE_DEBUG      
-      if (action != action_NOTHING) {
-        printMillis();
-        Serial.print("button press action: ");
-        Serial.println(action);
+      // send MIDI message for the same
+      midiBuildCommand(theWidget.oscAddress, midiPayload);
+      //midiOut.sendSysEx(commandLength, (byte*)bigMidiCommand, true); // char
+      midiOut.sendSysEx(strlen(bigMidiCommand), (byte*)bigMidiCommand, true); // char
+
+      // flash the LED as local acknowledgement if we are not listening for response;
+      // otherwise show a toggle's new state now, pending until the echo confirms it (see ackPoll)
+      if (!do_xRemote) 
+      {
+          ledFlash(theWidget.ledPin);
       }
+      else if (theWidget.isOscToggle)
+      {
+        theWidget.updateLed();
+        if (pressMicros)
+        {
+          ledFeedback.sample(micros() - pressMicros);
+        }
+      }
+
+      // DEBUG
+      printMillis();
+      theWidget.print();
+    };
+  }; // end for
+};
+
+void taskButtonsLoop(void *parameters)
+{
+  for (;;)
+  {
+    buttonsPoll();
+    coalescer.poll();
+    macroPoll();
+    rampPoll();
+    ackPoll();
+    ledPoll();
+#if SCHEDULE_PLAN
+    vTaskDelay(1); // at PRIORITY_BUTTONS nothing else on CORE_INPUT would run otherwise
+#else
+    // no need to add delay here, we want to poll buttons quickly
+#endif
+  };
+};
+
+// ***************************************************************
+// void relayPublish
+// - relay master: broadcast a parameter that peers want to the LAN
+// ***************************************************************
+void relayPublish(paramId_t id)
+{
+#if RELAY_ROLE == RELAY_MASTER
+  ParamEntry e;
+  if (!paramCache.get(id, e) || e.target != 0 || !(e.flags & param_RELAYED) || !(e.flags & param_CONFIRMED))
+  {
+    return;
+  }
+  OSCMessage msg(e.address);
+  switch (e.type)
+  {
+  case 'i':
+    msg.add(e.i);
+    break;
+  case 'f':
+    msg.add(e.f);
+    break;
+  case 's':
+    msg.add(e.s);
+    if (e.i >= 0)
+    {
+      msg.add(e.i);
+    }
+    break;
+  }
+  oscQueue(WiFi.broadcastIP(), RELAY_PORT, msg, TX_CLASS_REFRESH, 0);
 #endif
+}
+
+// ***************************************************************
+// void relayAnnounce
+// - relay peer: tell the master which addresses we want (the relay only covers the first console)
+// ***************************************************************
+void relayAnnounce()
+{
+  for (auto &theWidget : myWidgets)
+  {
+    if (theWidget.target == 0 && theWidget.paramId != PARAM_NONE && (theWidget.isOscToggle || theWidget.oscPayload_f >= 0))
+    {
+      OSCMessage msg("/relay/watch");
+      msg.add(theWidget.oscAddress);
+      msg.add((int32_t)((theWidget.isOscToggle) ? 'i' : 'f'));
+      oscQueue(WiFi.broadcastIP(), RELAY_PORT, msg, TX_CLASS_RENEWAL, 0);
+    }
+  }
+}
+
+// ***************************************************************
+// void oscReceived
+// - act on an OSC message from a console (or relayed from it)
+// - update paramCache, and the LEDs of matching widgets
+// ***************************************************************
+void oscReceived(uint8_t target, OSCMessage &msg)
+{
+  SubscriptionManager &subscriptions = consoleTargets[target].subscriptions;
+  char str[64];
+  int matched = 0;
 
-      if (action == theWidget.actionTrigger && action != action_NOTHING)
+  if (!msg.hasError())
+  {
+    // a /formatsubscribe reply carries all the subscribed values at once
+    paramId_t updated[SUBSCRIPTION_MAX];
+    int numberUpdated = subscriptions.onFormatReply(msg, updated);
+    for (int i = 0; i < numberUpdated; i++)
+    {
+      refreshEngine.onReply(updated[i]);
+      relayPublish(updated[i]);
+      for (auto &theWidget : myWidgets)
       {
-        // compose the OSC message
-        OSCMessage msg(theWidget.oscAddress);
-        if (theWidget.isOscToggle)
+        if (theWidget.paramId == updated[i] && theWidget.isOscToggle && theWidget.isActive())
         {
-          theWidget.oscState = (theWidget.oscState < 1) ? 1 : 0;                  // flip the state
-          theWidget.oscPayload_s = (theWidget.oscState < 1) ? stringOFF : stringON; // compose text for MIDI SysEx
-          msg.add(theWidget.oscState);
+          matched++;
+          theWidget.updateLed();
         }
-        else
+      }
+    }
+    if (numberUpdated >= 0)
+    {
+      Serial.print("FORMAT ");
+      Serial.println(numberUpdated);
+    }
+
+    // keep our mirror of the X32 up to date
+    paramId_t id = (numberUpdated < 0) ? paramCacheUpdate(target, msg) : PARAM_NONE;
+    subscriptions.onReceive(id);
+    if (refreshEngine.isRunning())
+    {
+      refreshEngine.onReply(id);
+      pokeNotify(); // there may be room for the next query
+    }
+    relayPublish(id);
+    showChangeCheck(id);
+
+    // do we recognise this OSC messsage?
+    for (auto &theWidget : myWidgets)
+    {
+      if (id != PARAM_NONE && theWidget.paramId == id && theWidget.isActive())
+      {
+        // yes we do, so let's take some action
+        matched++;
+        Serial.println();
+        Serial.print("MATCHES ");
+        Serial.print(theWidget.friendlyDebugName);
+
+        if (msg.isInt(0) && theWidget.isOscToggle)
         {
-          if (theWidget.oscPayload_f >= 0)
+          // for binary states 0 or 1
+          theWidget.updateLed();
+          if (!firstCorrectLedMillis)
           {
-            // assume fader-type OSC
-            msg.add(theWidget.oscPayload_f);
-            // convert float to string to compose text for MIDI SysEx; does MIDI SysEx method accept float?
-            itoa((int)((theWidget.oscPayload_f*127) + 0.5),stringNumber,10);
-            theWidget.oscPayload_s = stringNumber;
+            firstCorrectLedMillis = millis();
+            Serial.print(" (first LED confirmed by X32 ");
+            Serial.print(firstCorrectLedMillis);
+            Serial.print(" ms after boot)");
           }
-          else
+        }
+        else if (msg.isFloat(0))
+        {
+          // for fader-style
+          Serial.print(" FLOAT: ");
+          Serial.print(msg.getFloat(0));
+
+          // visual acknowledgement
+          ledFlash(theWidget.ledPin);
+        }
+        else if (msg.isString(0))
+        {
+          msg.getString(0, str, 64);
+
+          Serial.print(" STRING: '");
+          Serial.print(str);
+          if (msg.isInt(1))
           {
-            // assume snippet-type OSC
-            if (*theWidget.oscPayload_s)
-            {
-              msg.add(theWidget.oscPayload_s); // send the payload string if defined
-            };
-            if (theWidget.oscPayload_i >= 0)
-            {
-              msg.add(theWidget.oscPayload_i); // send the payload int (index) if defined
-            }
+            Serial.print("' INDEX: ");
+            Serial.print(msg.getInt(1));
           }
+          // visual acknowledgement
+          ledFlash(theWidget.ledPin);
+
+          // in this section the likely use case is /load, snippet
+          // X32 seems to return /load~~~,si~snippet~~~~N
+          // where N == 1 if valid, N == 0 if no such snippet
+          // so it is not possible to determine which snippet was loaded
+        
         };
+        Serial.println();
+      };
+    };
+    if (matched == 0)
+    {
+      Serial.println("NO MATCH");
+    }
+  }
+  else
+  {
+    Serial.print("ERROR: ");
+    Serial.println(msg.getError());
+    // typedef enum { OSC_OK = 0, BUFFER_FULL, INVALID_OSC, ALLOCFAILED, INDEX_OUT_OF_BOUNDS } OSCErrorCode;
+  };
+}
 
-        // send OSC message
-        Udp.beginPacket(X32Address, X32Port);
-        msg.send(Udp);
-        Udp.endPacket();
-        msg.empty();
+// ***************************************************************
+// void relayReceive
+// - master: register what peers want, and pass their commands on to the X32
+// - peer: act on the updates the master has relayed from the X32
+// ***************************************************************
+void relayReceive()
+{
+  int size = RelayUdp.parsePacket();
+  if (size <= 0 || RelayUdp.remoteIP() == WiFi.localIP())
+  {
+    return; // nothing, or our own broadcast
+  }
+  OSCMessage msg;
+  while (size--)
+  {
+    msg.fill(RelayUdp.read());
+  }
+  if (msg.hasError())
+  {
+    return;
+  }
+  consoleTargets[0].rxPackets++;
 
-        // X32 does not seem to echo back the Fader and Mute commands or Mute Group. Or at least the X32 Emulator...
-        if (do_xRemote && (theWidget.isOscToggle || theWidget.oscPayload_f >= 0))
-        {
-          // send OSC again for toggles (mutes) so we get an update
-          OSCMessage msg2(theWidget.oscAddress);
-          msg2.setAddress(theWidget.oscAddress);
-          Udp.beginPacket(X32Address, X32Port);
-          msg2.send(Udp);
-          Udp.endPacket();
-          msg2.empty();          
-        };
+#if RELAY_ROLE == RELAY_MASTER
+  if (msg.fullMatch("/relay/watch") && msg.isString(0))
+  {
+    char address[PARAM_ADDRESS_LEN];
+    msg.getString(0, address, PARAM_ADDRESS_LEN);
+    paramId_t id = paramCache.intern(address);
+    paramCache.setRelayed(id);
+    // the watch list is pokePoll's; if it is behind, the peer asks again within RELAY_ANNOUNCE_MS
+    relayWatches.push(RelayWatch{id, (msg.isInt(1)) ? (char)msg.getInt(1) : 'i'});
+    relayPublish(id); // bring the peer up to date straight away
+  }
+  else
+  {
+    sendOSC(0, msg, TX_CLASS_USER); // a peer's command on its way to the X32
+  }
+#else
+  if (!msg.fullMatch("/relay/watch")) // other peers' announcements are not for us
+  {
+    relayMasterAddress = (uint32_t)RelayUdp.remoteIP();
+    printMillis();
+    Serial.print("relayed: ");
+    oscReceived(0, msg);
+  }
+#endif
+}
 
-        // send MIDI message for the same
-        midiBuildCommand(theWidget.oscAddress, theWidget.oscPayload_s);
-        //midiOut.sendSysEx(commandLength, (byte*)bigMidiCommand, true); // char
-        midiOut.sendSysEx(strlen(bigMidiCommand), (byte*)bigMidiCommand, true); // char
+// ***************************************************************
+// bool oscDuplicate
+// - with TX_COPIES, every copy of a set or query may be answered: a message is a duplicate if it repeats, byte
+//   for byte, the last one from the same console for the same address, within RX_DUPLICATE_MS
+// - anything else for that address in between is not repeated, so on, off, on all get through
+// - receiving task only
+// ***************************************************************
+bool oscDuplicate(int target, const uint8_t *data, int size)
+{
+  uint32_t hash = 2166136261UL; // FNV-1a
+  uint32_t addressHash = 0;
+  for (int i = 0; i < size; i++)
+  {
+    if (!addressHash && !data[i])
+    {
+      addressHash = hash | 1; // the address ends at its first 0 byte
+    }
+    hash = (hash ^ data[i]) * 16777619UL;
+  }
+  unsigned long now = millis();
+  int slot = 0;
+  for (int r = 0; r < RX_DUPLICATE_SLOTS; r++)
+  {
+    if (rxRecent[r].addressHash == addressHash && rxRecent[r].target == target)
+    {
+      slot = r;
+      break;
+    }
+    if (now - rxRecent[r].millis > now - rxRecent[slot].millis)
+    {
+      slot = r; // the oldest, unless we find the address
+    }
+  }
+  if (rxRecent[slot].addressHash == addressHash && rxRecent[slot].target == target && rxRecent[slot].hash == hash && now - rxRecent[slot].millis < RX_DUPLICATE_MS)
+  {
+    return true;
+  }
+  rxRecent[slot].addressHash = addressHash;
+  rxRecent[slot].hash = hash;
+  rxRecent[slot].target = target;
+  rxRecent[slot].millis = now;
+  return false;
+}
 
-        // flash the LED as local acknowledgement if we are not listening for response
-        if (!do_xRemote) 
-        {
-            xTaskCreate(taskLedFlash, "taskLedFlash", 10000, (void*)(uint32_t)theWidget.ledPin, 1, NULL);
-        }
+// ***************************************************************
+// void oscUnpack
+// - one packet from a console: a message, or a #bundle of messages and bundles (up to OSC_BUNDLE_DEPTH deep),
+//   each message handed on in the order it was packed
+// - the time tag is ignored; everything is applied as it arrives
+// ***************************************************************
+void oscUnpack(int target, uint8_t *data, int size, int depth)
+{
+  ConsoleTarget &console = consoleTargets[target];
+  if (size >= OSC_BUNDLE_HEADER && memcmp(data, "#bundle", 8) == 0)
+  {
+    if (depth >= OSC_BUNDLE_DEPTH)
+    {
+      Serial.println("bundle nested too deep, ignored");
+      return;
+    }
+    int i = OSC_BUNDLE_HEADER;
+    while (i + 4 <= size)
+    {
+      int32_t length = ((int32_t)data[i] << 24) | ((int32_t)data[i + 1] << 16) | ((int32_t)data[i + 2] << 8) | data[i + 3];
+      i += 4;
+      if (length <= 0 || length > size - i)
+      {
+        Serial.println("bundle element length out of range, rest ignored");
+        return;
+      }
+      oscUnpack(target, data + i, length, depth + 1);
+      i += length;
+    }
+    return;
+  }
 
-        // DEBUG
-        printMillis();
-        theWidget.print();
-      };
-    }; // end for
-    // no need to add delay here, we want to poll buttons quickly
-  }; // end for ever loop
-};
+  OSCMessage msg;
+  msg.fill(data, size);
+  if (!msg.hasError() && msg.fullMatch("/info"))
+  {
+    console.liveness.onProbeReply();
+  }
+  else
+  {
+    console.liveness.onTraffic();
+    console.subscriptions.onTraffic();
+  }
+#if TX_COPIES > 1
+  if (oscDuplicate(target, data, size))
+  {
+    rxDuplicates++; // traffic all the same, but nothing new
+    return;
+  }
+#endif
+  oscReceived(target, msg);
+}
 
 // ***************************************************************
+// bool udpPoll
 // void taskUDPLoop
 // - watch state of the specified OSC states from UDP stream
+// - one socket for every console; each packet goes to the session of the console that sent it
 // - update LED accordingly
+// - (and the relay port, if we are part of a relay)
 // ***************************************************************
-void taskUDPLoop(void *parameters)
+bool udpPoll()
 {
   int size;
   byte n;
-  char str[64];
+  int target;
+  static uint8_t rxBuffer[RX_PACKET_MAX]; // only this task receives
+  IPAddress fromAddress;
+  uint16_t fromPort = 0;
 
-  bool odd = false;
-  unsigned long m = 0;
-  int matched = 0;
+  static bool odd = false;
+  static unsigned long m = 0;
 
-  for (;;)
+  udpStats.tick();
+  size = transport.receive(rxBuffer, RX_PACKET_MAX, fromAddress, fromPort);
+
+  if (millis() - m > 500)
   {
-    if (do_xRemote && WiFi.status() == WL_CONNECTED) {
-      OSCMessage msg;
-      size = Udp.parsePacket();
+    m = millis();
+    odd = !odd;
+    Serial.print((odd) ? "*\b" : ".\b"); // display heartbeat
+  }
+
+  target = (size > 0) ? targetFind(fromAddress, fromPort) : -1;
+  if (size > 0 && target < 0)
+  {
+    printMillis();
+    Serial.print("ignored packet from ");
+    Serial.print(fromAddress);
+    Serial.print(":");
+    Serial.println(fromPort);
+  }
+  else if (size > 0)
+  {
+    ConsoleTarget &console = consoleTargets[target];
+    console.rxPackets++;
+    console.rxBytes += size;
+    Serial.print("[");
+    Serial.print(millis());
+    Serial.print("] ");
+    Serial.print(size);
+    Serial.print(" bytes received: ");
 
-      if (millis() - m > 500)
+    for (int i = 0; i < size; i++)
+    {
+      n = rxBuffer[i];
+      if (n < 16)
       {
-        m = millis();
-        odd = !odd;
-        Serial.print((odd) ? "*\b" : ".\b"); // display heartbeat
+        Serial.print(" ");
+        Serial.print(n, HEX);
       }
-
-      if (size > 0)
+      else
       {
-        Serial.print("[");
-        Serial.print(millis());
-        Serial.print("] ");
-        Serial.print(size);
-        Serial.print(" bytes received: ");
+        Serial.print((char)n);
+      };
+    }
 
-        while (size--)
-        {
-          n = Udp.read();
-          msg.fill(n);
-          if (n < 16)
-          {
-            Serial.print(" ");
-            Serial.print(n, HEX);
-          }
-          else
-          {
-            Serial.print((char)n);
-          };
-        }
+    Serial.print(" --> ");
 
-        Serial.print(" --> ");
-        matched = 0;
+    oscUnpack(target, rxBuffer, size, 0);
+  };
 
-        if (!msg.hasError())
-        {
-          // do we recognise this OSC messsage?
-          for (auto &theWidget : myWidgets)
-          {
-            if (msg.fullMatch(theWidget.oscAddress))
-            {
-              // yes we do, so let's take some action
-              matched++;
-              Serial.println();
-              Serial.print("MATCHES ");
-              Serial.print(theWidget.friendlyDebugName);
-
-              if (msg.isInt(0) && theWidget.isOscToggle)
-              {
-                // for binary states 0 or 1
-                theWidget.oscState = msg.getInt(0);
-                if (theWidget.isReverseLed)
-                {
-                  theWidget.doDigitalWrite((theWidget.oscState > 0) ? LED_PIN_OFF : LED_PIN_ON);
-                }
-                else
-                {
-                  theWidget.doDigitalWrite((theWidget.oscState > 0) ? LED_PIN_ON : LED_PIN_OFF);
-                }
-              }
-              else if (msg.isFloat(0))
-              {
-                // for fader-style
-                Serial.print(" FLOAT: ");
-                Serial.print(msg.getFloat(0));
-
-                // visual acknowledgement
-                xTaskCreate(taskLedFlash, "taskLedFlash", 10000, (void*)(uint32_t)theWidget.ledPin, 1, NULL);
-              }
-              else if (msg.isString(0))
-              {
-                msg.getString(0, str, 64);
-
-                Serial.print(" STRING: '");
-                Serial.print(str);
-                if (msg.isInt(1))
-                {
-                  Serial.print("' INDEX: ");
-                  Serial.print(msg.getInt(1));
-                }
-                // visual acknowledgement
-                xTaskCreate(taskLedFlash, "taskLedFlash", 10000, (void*)(uint32_t)theWidget.ledPin, 1, NULL);
-
-                // in this section the likely use case is /load, snippet
-                // X32 seems to return /load~~~,si~snippet~~~~N
-                // where N == 1 if valid, N == 0 if no such snippet
-                // so it is not possible to determine which snippet was loaded
-              
-              };
-              Serial.println();
-            };
-          };
-          if (matched == 0)
-          {
-            Serial.println("NO MATCH");
-          }
-        }
-        else
-        {
-          Serial.print("ERROR: ");
-          Serial.println(msg.getError());
-          // typedef enum { OSC_OK = 0, BUFFER_FULL, INVALID_OSC, ALLOCFAILED, INDEX_OUT_OF_BOUNDS } OSCErrorCode;
-        };
-      };
+#if RELAY_ROLE != RELAY_NONE
+  relayReceive();
+#endif
+  return size > 0;
+};
+
+void taskUDPLoop(void *parameters)
+{
+  for (;;)
+  {
+    if (do_xRemote && WiFi.status() == WL_CONNECTED) {
+      while (udpPoll())
+      {
+        // everything waiting: the raw transport only holds RX_QUEUE_SIZE packets
+      }
     } else
     {
-      // else if no wifi, or not monitoring X32 then suspend myself
+      // else if no wifi, or not monitoring X32 then sleep
       printMillis();
-      Serial.println("taskUDPLoop suspending itself.");
-      // depends on WiFiGotIP or taskButtonsLoop to Resume
-      vTaskSuspend(xUDPLoopHandle);
+      Serial.println("taskUDPLoop waiting.");
+      // depends on WiFiGotIP or taskButtonsLoop to wake us (taskWake); a wake sent before we sleep is not lost
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     }
     vTaskDelay(10 / portTICK_PERIOD_MS); // looks like small delay is needed...
   };
 };
 
 // ***************************************************************
+// void pokePoll
 // void taskPokeOSCLoop
 // -  ask the X32 for its values
 // ***************************************************************
-void taskPokeOSCLoop(void *parameters)
+void pokePoll()
 {
-  int doneLedOff = false;
-  for (;;)
+  static int doneLedOff = false;
+  paramId_t toSend[REFRESH_WINDOW];
+  ParamEntry e;
+  int n;
+  static unsigned long announceMillis = 0;
+  bool anyDead;
+  bool settled;
+
+  pokeStats.tick();
+  if (do_xRemote && WiFi.status() == WL_CONNECTED)
   {
-    if (do_xRemote && WiFi.status() == WL_CONNECTED)
+    doneLedOff = false;
+#if RELAY_ROLE == RELAY_PEER
+    // the relay master holds the subscription for us
+    if (!announceMillis || (millis() - announceMillis) > RELAY_ANNOUNCE_MS)
+    {
+      announceMillis = millis();
+      relayAnnounce();
+    }
+#else
+    RelayWatch watch;
+    while (relayWatches.pop(watch))
+    {
+      consoleTargets[0].subscriptions.watch(watch.id, watch.type);
+    }
+    anyDead = false;
+    for (auto &console : consoleTargets)
+    {
+      if (console.liveness.tick() == LIVE_DEAD)
+      {
+        // nothing we know about this console can be trusted now; lit LEDs blink as stale until the resync
+        const char *const everything[] = {"/"};
+        paramCache.invalidate(console.index, everything, 1);
+      }
+      anyDead |= (console.liveness.state() == LIVE_DEAD);
+      if (console.subscriptions.tick()) // /xremote or /subscribe, and renewals
+      {
+        do_Refresh = true; // subscription had expired; we may have missed changes
+      }
+    }
+    if (anyDead)
     {
-      // if we can be one of the allowed xRemote clients then renew the /xremote request
-      Serial.print("/xremote\b\b\b\b\b\b\b\b");
-      doneLedOff = false;
+      ledWrite(PIN_FOR_WIFI_STATUS_LED, ((millis() / 100) & 1) ? LED_PIN_ON : LED_PIN_OFF); // fast blink
+    }
+#endif
 
-      OSCMessage msg("/xremote");
-      Udp.beginPacket(X32Address, X32Port);
-      msg.send(Udp);
-      Udp.endPacket();
-      msg.empty();
+    settled = true; // give a short while for the subscriptions to take effect
+    for (auto &console : consoleTargets)
+    {
+      settled &= (millis() - console.subscriptions.activeSinceMillis()) > 20;
+    }
+    if (settled && do_Refresh.exchange(false))
+    {
+      for (auto &theWidget : myWidgets)
+      {
+        if (theWidget.isOscToggle)
+        {
+          refreshEngine.request(theWidget.paramId);
+        }
+      };
+    };
 
-      if (do_Refresh) {
-        do_Refresh = false;
-        vTaskDelay(20 / portTICK_PERIOD_MS); // give a short while for xremote to take effect
-        for (auto &theWidget : myWidgets)
+    // send whatever queries the refresh engine has room for, one bundle per console
+    n = refreshEngine.tick(toSend);
+    if (n > 0)
+    {
+      OSCMessage queries[REFRESH_WINDOW];
+      uint8_t queryTarget[REFRESH_WINDOW];
+      for (int i = 0; i < n; i++)
+      {
+        paramCache.get(toSend[i], e);
+        queries[i].setAddress(e.address);
+        queryTarget[i] = e.target;
+      };
+      for (uint8_t t = 0; t < NUMBER_OF_TARGETS; t++)
+      {
+        OSCMessage *batch[REFRESH_WINDOW];
+        int m = 0;
+        for (int i = 0; i < n; i++)
         {
-          if (theWidget.isOscToggle)
+          if (queryTarget[i] == t)
           {
-            OSCMessage msg(theWidget.oscAddress);
-            Udp.beginPacket(X32Address, X32Port);
-            msg.send(Udp);
-            Udp.endPacket();
-            msg.empty();
+            batch[m++] = &queries[i];
           }
-        };
-      };
-      vTaskDelay(9000 / portTICK_PERIOD_MS); // renew request before 10 seconds
+        }
+        if (m)
+        {
+          oscSendAll(t, batch, m, TX_CLASS_REFRESH | TX_IDEMPOTENT, 0);
+        }
+      }
+    };
+
+    unsigned long changeMillis = showChangeMillis;
+    if (changeMillis && !refreshEngine.isRunning())
+    {
+      printMillis();
+      Serial.print("show change: consistent after ");
+      Serial.print(millis() - changeMillis);
+      Serial.println(" ms");
+      showChangeMillis = 0;
     }
-    else
+  }
+  else
+  {
+    for (auto &console : consoleTargets)
+    {
+      console.liveness.reset();
+      console.subscriptions.stop();
+    }
+    announceMillis = 0;
+    // turn off all the LEDs if not monitoring X32
+    // or if WiFi disconnected
+    if (!doneLedOff)
     {
-      // turn off all the LEDs after the 9 seconds above has expired
-      // or if WiFi disconnected
-      if (!doneLedOff)
+      doneLedOff = true;
+      for (auto &theWidget : myWidgets)
       {
-        doneLedOff = true;
-        for (auto &theWidget : myWidgets)
-        {
-          theWidget.doDigitalWrite(LED_PIN_OFF);
-        };
-        Serial.print("/-------\b\b\b\b\b\b\b\b");
+        theWidget.doDigitalWrite(LED_PIN_OFF);
       };
+      Serial.print("/-------\b\b\b\b\b\b\b\b");
     };
-    vTaskDelay(10 / portTICK_PERIOD_MS); // looks like small delay is needed...
   };
 };
 
+void taskPokeOSCLoop(void *parameters)
+{
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY); // wait until WiFi ok (WiFiGotIP)
+  for (;;)
+  {
+    pokePoll();
+    // sleep until a reply frees a refresh slot, or 10 ms at most
+    ulTaskNotifyTake(pdTRUE, 10 / portTICK_PERIOD_MS);
+  };
+};
+
+// ***************************************************************
+// bool nvsQuiet
+// - with USE_REACTOR a flash write is the one loop's own time: for milliseconds no button, packet in or packet out
+//   is seen to; so NVS waits until nothing is in flight, i.e. no command awaiting acknowledgement, no fade, and
+//   nothing queued to send
+// - the task model writes from taskStatusLoop, at background priority, whenever a write is due
+// ***************************************************************
+bool nvsQuiet()
+{
+#ifdef USE_REACTOR
+  for (int r = 0; r < RAMP_SLOTS; r++)
+  {
+    if (ramps[r].durationMs)
+    {
+      return false;
+    }
+  }
+  return acks.idle() && transport.idle();
+#else
+  return true; // the acks and fades are the buttons task's
+#endif
+}
+
 // ***************************************************************
+// void statusPoll
 // void taskStatusLoop
 // - monitor battery and wifi status
+// - blink LEDs restored from NVS until the X32 confirms them
+// - save the X32 state to NVS when it has settled
 // ***************************************************************
-void taskStatusLoop(void *parameters)
+void statusPoll()
 {
   int batteryLevel;
-  int batteryStatusLed = LED_PIN_ON;
-  int wifiStatusLed = LED_PIN_ON;
-  int lastWifiStatus = 99; // start with an undefined number
+  static int batteryStatusLed = LED_PIN_ON;
+  static int wifiStatusLed = LED_PIN_ON;
+  static int lastWifiStatus = 99; // start with an undefined number
   wl_status_t wifiStatus;
+  static bool staleBlink = false;
+  int unconfirmed;
+  static int ticks = 0;
+  static int minuteTicks = 0;
+  bool anyDead;
   
-  for (;;)
+  // stale LEDs: lit LEDs blink until the X32 confirms their state
+  staleBlink = !staleBlink;
+  unconfirmed = 0;
+  for (auto &theWidget : myWidgets)
   {
-    // check WiFi status and adjust led indicator
-    wifiStatus = WiFi.status();
-    if (wifiStatus == WL_CONNECTED)
+    if (!theWidget.isOscToggle || !theWidget.isActive())
+    {
+      continue;
+    }
+    if (!paramCache.isConfirmed(theWidget.paramId))
+    {
+      unconfirmed++;
+    }
+    if (do_xRemote && paramCache.isStale(theWidget.paramId))
     {
-      wifiStatusLed = LED_PIN_ON;
-      if (wifiStatus != lastWifiStatus)
+      if (staleBlink)
+      {
+        theWidget.updateLed();
+      }
+      else
+      {
+        theWidget.doDigitalWrite(LED_PIN_OFF);
+      }
+      if (!paramCache.isStale(theWidget.paramId))
       {
-        lastWifiStatus = wifiStatus;
+        theWidget.updateLed(); // confirmed while we were blinking
       }
     }
-    else
+  }
+  if (unconfirmed == 0 && !allCorrectLedMillis)
+  {
+    allCorrectLedMillis = millis();
+    printMillis();
+    Serial.print("all LEDs confirmed by X32 ");
+    Serial.print(allCorrectLedMillis);
+    Serial.print(" ms after boot (first after ");
+    Serial.print(firstCorrectLedMillis);
+    Serial.println(" ms)");
+  }
+  nvsStateStore.tick(nvsQuiet());
+
+  // inbound traffic every 10 seconds, so subscription modes can be compared
+  if (++ticks >= 20)
+  {
+    ticks = 0;
+    for (auto &console : consoleTargets)
     {
-      wifiStatusLed = (wifiStatusLed == LED_PIN_ON) ? LED_PIN_OFF : LED_PIN_ON; // flip the state of the LED
-      if (wifiStatus != lastWifiStatus)
+      if (console.subscriptions.isActive())
       {
-        lastWifiStatus = wifiStatus;
         printMillis();
-        Serial.print("WiFi not connected.  WiFi.status() is: ");
-        Serial.println(wl_status_to_string(wifiStatus));
+        Serial.print("rx ");
+        Serial.print(console.name);
+        Serial.print(": ");
+        Serial.print(console.rxPackets);
+        Serial.print(" packets, ");
+        Serial.print(console.rxBytes);
+        Serial.print(" bytes in 10 s, subscription mode ");
+        Serial.print(console.subscriptions.effectiveMode());
+        Serial.print(" for ");
+        Serial.print(console.subscriptions.size());
+        Serial.println(" addresses");
       }
-    };
-    digitalWrite(PIN_FOR_WIFI_STATUS_LED, wifiStatusLed);
-
-    // check battery status
-    batteryLevel = analogRead(PIN_FOR_BATTERY_VOLTAGE);
-    if (batteryLevel < BATTERY_LOW_CUTOFF)
+      console.rxPackets = 0;
+      console.rxBytes = 0;
+    }
+  }
+  // liveness, and how long jobs wait for their turn, every minute
+  minuteTicks = (minuteTicks + 1) % 120;
+  if (minuteTicks == 0)
+  {
+    printMillis();
+    Serial.print("free heap ");
+    Serial.print(ESP.getFreeHeap());
+    Serial.print(", min ");
+    Serial.print(ESP.getMinFreeHeap());
+#ifdef USE_REACTOR
+    Serial.print(" (reactor); stack ");
+#else
+    Serial.print(" (tasks); status task stack ");
+#endif
+    Serial.print(uxTaskGetStackHighWaterMark(NULL));
+    Serial.println(" bytes never used");
+    buttonsStats.print("buttons");
+    udpStats.print("udp");
+    pokeStats.print("poke");
+    pressLatency.print("press to send");
+    printMillis();
+    transport.print();
+    coalescer.print();
+    macroBuild.print("macro build");
+    rampFrame.print("fade frame");
+    Serial.print("fades cancelled ");
+    Serial.println(rampsCancelled);
+    ledFeedback.print("press to LED");
+    Serial.print("LED changes dropped (queue full) ");
+    Serial.println(ledQueueDrops.exchange(0));
+    ackLatency.print("press to confirmed");
+    Serial.print("delivered after 0..");
+    Serial.print(ACK_RETRIES);
+    Serial.print(" resends:");
+    for (int r = 0; r <= ACK_RETRIES; r++)
     {
-      batteryStatusLed = (batteryStatusLed == LED_PIN_ON) ? LED_PIN_OFF : LED_PIN_ON; // flip the state of the LED
+      Serial.print(" ");
+      Serial.print(acks.retriedCount(r));
     }
-    else if (batteryLevel > BATTERY_FULL_CUTOFF)
+    Serial.print("; ");
+    Serial.print(acks.failedCount());
+    Serial.print(" failed, ");
+    Serial.print(acks.untrackedCount());
+    Serial.println(" untracked");
+    if (paramCache.overflowCount())
     {
-      batteryStatusLed = LED_PIN_ON;
+      Serial.print("paramCache full: ");
+      Serial.print(paramCache.overflowCount());
+      Serial.println(" addresses not cached (PARAM_CACHE_SIZE)");
     }
-    else
+#if TX_COPIES > 1
+    Serial.print("rx duplicates dropped ");
+    Serial.println(rxDuplicates);
+#endif
+    Serial.print("fader ");
+    Serial.print(faderSent.exchange(0));
+    Serial.print(" sent, ");
+    Serial.print(faderSuppressed.exchange(0));
+    Serial.print(" suppressed (console already there), ");
+    Serial.print(faderQuantised.exchange(0));
+    Serial.println(" quantised");
+    taskCpuPrint();
+  }
+  anyDead = false;
+  for (auto &console : consoleTargets)
+  {
+    if (minuteTicks == 0)
+    {
+      printMillis();
+      console.liveness.print();
+    }
+    anyDead |= (console.liveness.state() == LIVE_DEAD);
+  }
+
+  // check WiFi status and adjust led indicator
+  wifiStatus = WiFi.status();
+  if (wifiStatus == WL_CONNECTED)
+  {
+    wifiStatusLed = LED_PIN_ON;
+    if (wifiStatus != lastWifiStatus)
+    {
+      lastWifiStatus = wifiStatus;
+    }
+  }
+  else
+  {
+    wifiStatusLed = (wifiStatusLed == LED_PIN_ON) ? LED_PIN_OFF : LED_PIN_ON; // flip the state of the LED
+    if (wifiStatus != lastWifiStatus)
     {
-      batteryStatusLed = LED_PIN_OFF;
+      lastWifiStatus = wifiStatus;
+      printMillis();
+      Serial.print("WiFi not connected.  WiFi.status() is: ");
+      Serial.println(wl_status_to_string(wifiStatus));
     }
-    digitalWrite(PIN_FOR_BATTERY_STATUS_LED, batteryStatusLed);
+  };
+  if (!anyDead) // otherwise taskPokeOSCLoop blinks it fast
+  {
+    ledWrite(PIN_FOR_WIFI_STATUS_LED, wifiStatusLed);
+  }
+
+  // check battery status
+  batteryLevel = analogRead(PIN_FOR_BATTERY_VOLTAGE);
+  if (batteryLevel < BATTERY_LOW_CUTOFF)
+  {
+    batteryStatusLed = (batteryStatusLed == LED_PIN_ON) ? LED_PIN_OFF : LED_PIN_ON; // flip the state of the LED
+  }
+  else if (batteryLevel > BATTERY_FULL_CUTOFF)
+  {
+    batteryStatusLed = LED_PIN_ON;
+  }
+  else
+  {
+    batteryStatusLed = LED_PIN_OFF;
+  }
+  digitalWrite(PIN_FOR_BATTERY_STATUS_LED, batteryStatusLed);
 #ifdef VERBOSE_DEBUG    
-    Serial.print("Batt:");
-    Serial.print(batteryLevel);
-    Serial.print("   \b\b\b\b\b\b\b\b\b\b\b\b");
+  Serial.print("Batt:");
+  Serial.print(batteryLevel);
+  Serial.print("   \b\b\b\b\b\b\b\b\b\b\b\b");
 #endif
+};
+
+void taskStatusLoop(void *parameters)
+{
+  for (;;)
+  {
+    statusPoll();
     // delay for flashing LED and for this loop
     vTaskDelay(500 / portTICK_PERIOD_MS); // delay 500 ms
   }
 };
 
+// ***************************************************************
+// void taskTxLoop
+// - the TX owner: the only task that sends to the consoles (and the relay)
+// - sleeps until something is queued (oscQueue wakes it), or until the rate limit lets held-back packets go
+// ***************************************************************
+void taskTxLoop(void *parameters)
+{
+  unsigned long heldMillis = 0;
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, (heldMillis) ? heldMillis / portTICK_PERIOD_MS + 1 : portMAX_DELAY);
+    heldMillis = transport.flush(pressSent);
+  }
+};
+
+// ***************************************************************
+// void taskReactorLoop
+// - with USE_REACTOR, this one task does the work of taskUDPLoop, taskButtonsLoop,
+//   taskPokeOSCLoop, taskStatusLoop and taskTxLoop, and owns the LEDs
+// - in priority order: what the consoles say, the buttons, then the timers
+// ***************************************************************
+void taskReactorLoop(void *parameters)
+{
+  unsigned long now;
+  unsigned long pokeMillis = 0;
+  unsigned long statusMillis = 0;
+
+  for (;;)
+  {
+    if (do_xRemote && WiFi.status() == WL_CONNECTED)
+    {
+      for (int i = 0; i < REACTOR_RX_BUDGET && udpPoll(); i++)
+      {
+      }
+    }
+    buttonsPoll();
+    coalescer.poll();
+    macroPoll();
+    rampPoll();
+    ackPoll();
+    transport.flush(pressSent); // presses out before anything else happens
+
+    now = millis();
+    if (pokeDue || (now - pokeMillis) >= REACTOR_POKE_MS)
+    {
+      pokeDue = false;
+      pokeMillis = now;
+      pokePoll();
+      transport.flush(pressSent);
+    }
+    ledPoll();
+    if ((now - statusMillis) >= REACTOR_STATUS_MS)
+    {
+      statusMillis = now;
+      statusPoll();
+    }
+    vTaskDelay(1); // let the idle task feed the watchdog
+  }
+};
+
 // ***************************************************************
 // void loop - MAIN LOOP
 // ***************************************************************
@@ -778,21 +5180,97 @@ void setup()
   pinMode(PIN_FOR_MODE_SWITCH, INPUT_PULLUP);
   modeButton.begin();
 
-  // flash all LED as self-test
+  // number the consoles and index them by source address
+  targetIndexBuild();
+
+  // intern the widget addresses; from now on widgets refer to their state in paramCache by paramId
+  for (auto &theWidget : myWidgets)
+  {
+    if (theWidget.target >= NUMBER_OF_TARGETS)
+    {
+      Serial.print(theWidget.friendlyDebugName);
+      Serial.println(": no such console target, using 0");
+      theWidget.target = 0;
+    }
+    if (!theWidget.resolve(consoleTargets[theWidget.target].family))
+    {
+      Serial.print(theWidget.friendlyDebugName);
+      Serial.println(": no such parameter on this console, disabled");
+      theWidget.actionTrigger = action_NOTHING;
+      continue;
+    }
+    if (theWidget.macro)
+    {
+      // steps are resolved as they run; say now which ones this console has no address for
+      for (int s = 0; s < theWidget.macroLength; s++)
+      {
+        char address[PARAM_ADDRESS_LEN];
+        bool inverted;
+        if (!schemaResolve(theWidget.macro[s].param, consoleTargets[theWidget.target].family, address, PARAM_ADDRESS_LEN, inverted))
+        {
+          Serial.print(theWidget.friendlyDebugName);
+          Serial.print(": step ");
+          Serial.print(s);
+          Serial.println(" has no such parameter on this console, skipped");
+        }
+      }
+      continue;
+    }
+    theWidget.paramId = paramCache.intern(theWidget.oscAddress, theWidget.target);
+    paramCache.setWatched(theWidget.paramId);
+    if (theWidget.isOscToggle || theWidget.oscPayload_f >= 0)
+    {
+      consoleTargets[theWidget.target].subscriptions.watch(theWidget.paramId, (theWidget.isOscToggle) ? 'i' : 'f');
+    }
+  }
+  // /xremote tells us about scene and snippet changes anyway, subscriptions need to ask
+  for (auto &console : consoleTargets)
+  {
+    char address[PARAM_ADDRESS_LEN];
+    bool inverted;
+    if (schemaResolve(LogicalParam{LP_SHOW_CURRENT, 0}, console.family, address, PARAM_ADDRESS_LEN, inverted))
+    {
+      console.subscriptions.watch(paramCache.intern(address, console.index), 'i');
+    }
+  }
+#if RELAY_ROLE == RELAY_MASTER
+  // peers need to hear about show changes too
+  for (auto &event : showEvents)
+  {
+    paramCache.setRelayed(paramCache.intern(event.address));
+  }
+#endif
+  Serial.print("paramCache: ");
+  Serial.print(paramCache.size());
+  Serial.print(" of ");
+  Serial.print(PARAM_CACHE_SIZE);
+  Serial.println(" entries used at boot");
+
+  // flash all LED as self-test (directly, as nothing is running ledPoll yet)
   for (auto &theWidget : myWidgets)
   {
-    theWidget.doDigitalWrite(LED_PIN_ON);
+    digitalWrite(theWidget.ledPin, LED_PIN_ON);
   }
   digitalWrite(PIN_FOR_WIFI_STATUS_LED, LED_PIN_ON);
   digitalWrite(PIN_FOR_BATTERY_STATUS_LED, LED_PIN_ON);
   delay(500); // shorten this if we want to start even faster
   for (auto &theWidget : myWidgets)
   {
-    theWidget.doDigitalWrite(LED_PIN_OFF);
+    digitalWrite(theWidget.ledPin, LED_PIN_OFF);
   };
   digitalWrite(PIN_FOR_WIFI_STATUS_LED, LED_PIN_OFF);
   digitalWrite(PIN_FOR_BATTERY_STATUS_LED, LED_PIN_OFF);
 
+  // show the last known X32 state (as stale) while we wait for WiFi
+  int restored = nvsStateStore.restore();
+  for (auto &theWidget : myWidgets)
+  {
+    if (theWidget.isOscToggle && theWidget.isActive() && paramCache.isStale(theWidget.paramId))
+    {
+      theWidget.updateLed();
+    }
+  }
+
   // send greetings to debug screen
   Serial.println();
   Serial.println("*******************************");
@@ -809,16 +5287,30 @@ void setup()
 #endif
   }
   Serial.println("*******************************");
-  Serial.print("X32 Address: ");
-  Serial.print(X32Address);
-  Serial.print(":");
-  Serial.println(X32Port);
+  for (auto &console : consoleTargets)
+  {
+    Serial.print("Console ");
+    console.print();
+  }
   Serial.print("WiFi SSID:   ");
   Serial.println(ssid);
   Serial.print("Local Port:  ");
   Serial.println(localPort);
+#if RELAY_ROLE != RELAY_NONE
+  Serial.print("Relay:       ");
+  Serial.print((RELAY_ROLE == RELAY_MASTER) ? "master" : "peer");
+  Serial.print(" on port ");
+  Serial.println(RELAY_PORT);
+#endif
+  Serial.print("Scheduling:  ");
+  Serial.println((SCHEDULE_PLAN) ? "buttons and LEDs on core 1, network on core 0" : "any core, equal priority");
   Serial.print("MAC Address: ");
   Serial.println(WiFi.macAddress());
+  Serial.print("From NVS:    ");
+  Serial.print(restored);
+  Serial.print(" states restored at ");
+  Serial.print(millis());
+  Serial.println(" ms");
   Serial.println("*******************************");
 
   float batteryLevel; // random values when battery is disconnected
@@ -836,13 +5328,16 @@ void setup()
   WiFi.begin(ssid, pass);
 
   // start our multitasking loops
-  // xTaskCreate( function_name, "task name", stack_size, task_parameters, priority, task_handle );
-  xTaskCreate(taskButtonsLoop,  "taskButtonsLoop",  10000,  NULL, 1, NULL);
-  xTaskCreate(taskUDPLoop,      "taskUDPLoop",      10000,  NULL, 1, &xUDPLoopHandle);
-  vTaskSuspend(xUDPLoopHandle); // wait until WiFI ok
-  xTaskCreate(taskPokeOSCLoop,  "taskPokeOSCLoop",  10000,  NULL, 1, &xPokeOSCLoopHandle);
-  vTaskSuspend(xPokeOSCLoopHandle); // wait until WiFI ok
-  xTaskCreate(taskStatusLoop,   "taskStatusLoop",   10000,   NULL, 1, NULL);
+  // taskStart( function_name, "task name", stack_bytes, task_parameters, priority, core, task_handle ); see SCHEDULE_PLAN
+#ifdef USE_REACTOR
+  taskStart(taskReactorLoop,  "taskReactorLoop",  STACK_REACTOR, NULL, PRIORITY_BUTTONS,    CORE_INPUT,   NULL);
+#else
+  taskStart(taskButtonsLoop,  "taskButtonsLoop",  STACK_TASK,    NULL, PRIORITY_BUTTONS,    CORE_INPUT,   NULL);
+  taskStart(taskTxLoop,       "taskTxLoop",       STACK_TASK,    NULL, PRIORITY_TX,         CORE_NETWORK, &xTxLoopHandle);
+  taskStart(taskUDPLoop,      "taskUDPLoop",      STACK_TASK,    NULL, PRIORITY_NETWORK,    CORE_NETWORK, &xUDPLoopHandle);
+  taskStart(taskPokeOSCLoop,  "taskPokeOSCLoop",  STACK_TASK,    NULL, PRIORITY_NETWORK,    CORE_NETWORK, &xPokeOSCLoopHandle);
+  taskStart(taskStatusLoop,   "taskStatusLoop",   STACK_TASK,    NULL, PRIORITY_BACKGROUND, CORE_INPUT,   NULL);
+#endif
   WiFi.onEvent(WiFiStationConnected, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_CONNECTED);
   WiFi.onEvent(WiFiGotIP, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_GOT_IP);
   WiFi.onEvent(WiFiStationDisconnected, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
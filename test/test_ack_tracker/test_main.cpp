@@ -0,0 +1,242 @@
+// ***************************************************************
+// AckTracker on the PC, over a link that loses packets: pio test -e native
+// - the console echoes every command it gets, and the echo is the acknowledgement, as for an X32 toggle
+// ***************************************************************
+#include <unity.h>
+
+#include <deque>
+
+#include "../../src/AckTracker.h"
+
+#define SLOTS 8
+#define FIRST_MS 80
+#define MAX_MS 1000
+#define RETRIES 5
+#define LINK_DELAY_MS 5 // each way
+#define ROUNDS 1000
+
+struct Sender
+{
+  int index;
+};
+
+typedef AckTracker<Sender, SLOTS, FIRST_MS, MAX_MS, RETRIES> Tracker;
+
+struct Packet
+{
+  int sender;
+  int32_t value;
+  unsigned long arrivesMillis;
+};
+
+// one way: lossPercent of the packets are lost, the rest arrive LINK_DELAY_MS later, in order
+class LossyLink
+{
+public:
+  LossyLink(int theLossPercent, uint32_t &theRandom) : lossPercent(theLossPercent), random(theRandom) {};
+
+  void send(int sender, int32_t value, unsigned long now)
+  {
+    random = random * 1664525u + 1013904223u; // same sequence every run
+    if ((random >> 16) % 100 < (uint32_t)lossPercent)
+    {
+      return;
+    }
+    inFlight.push_back(Packet{sender, value, now + LINK_DELAY_MS});
+  };
+
+  bool receive(unsigned long now, Packet &packet)
+  {
+    if (inFlight.empty() || (long)(now - inFlight.front().arrivesMillis) < 0)
+    {
+      return false;
+    }
+    packet = inFlight.front();
+    inFlight.pop_front();
+    return true;
+  };
+
+private:
+  int lossPercent;
+  uint32_t &random;
+  std::deque<Packet> inFlight;
+};
+
+void setUp() {}
+void tearDown() {}
+
+// n commands at once, one per sender, resent as the tracker says until each is acknowledged or given up;
+// returns the worst time to acknowledgement
+static unsigned long run(Tracker &tracker, Sender *senders, int n, int lossPercent, uint32_t &random, unsigned long now)
+{
+  LossyLink toConsole(lossPercent, random);
+  LossyLink fromConsole(lossPercent, random);
+  unsigned long worst = 0;
+  for (int s = 0; s < n; s++)
+  {
+    TEST_ASSERT_TRUE(tracker.track(&senders[s], s + 1, 0, 0, now));
+    toConsole.send(s, s + 1, now);
+  }
+  for (unsigned long end = now + 60000; !tracker.idle() && now != end; now++)
+  {
+    Packet packet;
+    while (toConsole.receive(now, packet))
+    {
+      fromConsole.send(packet.sender, packet.value, now);
+    }
+    while (fromConsole.receive(now, packet))
+    {
+      for (uint8_t a = 0; a < SLOTS; a++)
+      {
+        // a late echo of a resend, after the acknowledgement, finds no command
+        if (tracker.command(a).sender == &senders[packet.sender] && tracker.command(a).value == packet.value)
+        {
+          unsigned long ms = tracker.acknowledge(a, now);
+          worst = (ms > worst) ? ms : worst;
+        }
+      }
+    }
+    for (uint8_t a = 0; a < SLOTS; a++)
+    {
+      if (!tracker.command(a).sender)
+      {
+        continue;
+      }
+      switch (tracker.due(a, now))
+      {
+      case Tracker::ACK_GIVE_UP:
+        tracker.fail(a);
+        break;
+      case Tracker::ACK_RESEND:
+        toConsole.send(tracker.command(a).sender->index, tracker.command(a).value, now);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+  TEST_ASSERT_TRUE(tracker.idle());
+  return worst;
+}
+
+static uint32_t acknowledged(Tracker &tracker)
+{
+  uint32_t n = 0;
+  for (uint8_t r = 0; r <= RETRIES; r++)
+  {
+    n += tracker.retriedCount(r);
+  }
+  return n;
+}
+
+// ***************************************************************
+// nothing lost: every command acknowledged first time, one round trip after the send
+// ***************************************************************
+void test_no_loss()
+{
+  static Tracker tracker;
+  Sender senders[SLOTS];
+  uint32_t random = 1;
+  for (int s = 0; s < SLOTS; s++)
+  {
+    senders[s].index = s;
+  }
+  TEST_ASSERT_EQUAL_UINT32(2 * LINK_DELAY_MS, run(tracker, senders, SLOTS, 0, random, 1000));
+  TEST_ASSERT_EQUAL_UINT32(SLOTS, tracker.retriedCount(0));
+  TEST_ASSERT_EQUAL_UINT32(0, tracker.failedCount());
+}
+
+// ***************************************************************
+// everything lost: resent after FIRST_MS, the wait doubling up to MAX_MS, then given up after RETRIES resends
+// ***************************************************************
+void test_backoff_then_give_up()
+{
+  static Tracker tracker;
+  Sender sender{0};
+  const unsigned long expected[RETRIES + 1] = {80, 240, 560, 1200, 2200, 3200}; // the resends, then giving up
+  int n = 0;
+  unsigned long start = 0xFFFFF000UL; // across millis() wrapping round
+  tracker.track(&sender, 1, 0, 0, start);
+  for (unsigned long t = 0; t <= 4000 && tracker.command(0).sender; t++)
+  {
+    Tracker::Due due = tracker.due(0, start + t);
+    if (due == Tracker::ACK_WAIT)
+    {
+      continue;
+    }
+    TEST_ASSERT_TRUE(n <= RETRIES);
+    TEST_ASSERT_EQUAL_UINT32(expected[n], t);
+    TEST_ASSERT_EQUAL(n < RETRIES ? Tracker::ACK_RESEND : Tracker::ACK_GIVE_UP, due);
+    if (due == Tracker::ACK_GIVE_UP)
+    {
+      tracker.fail(0);
+    }
+    n++;
+  }
+  TEST_ASSERT_EQUAL(RETRIES + 1, n);
+  TEST_ASSERT_EQUAL_UINT32(1, tracker.failedCount());
+  TEST_ASSERT_EQUAL_UINT32(0, acknowledged(tracker));
+}
+
+// ***************************************************************
+// 30% lost each way, as bad WiFi: every command resolved, nearly all acknowledged, with the resends counted
+// ***************************************************************
+void test_lossy_link()
+{
+  static Tracker tracker;
+  Sender senders[SLOTS];
+  uint32_t random = 12345;
+  unsigned long worst = 0;
+  for (int s = 0; s < SLOTS; s++)
+  {
+    senders[s].index = s;
+  }
+  for (int round = 0; round < ROUNDS; round++)
+  {
+    unsigned long ms = run(tracker, senders, SLOTS, 30, random, round * 10000UL);
+    worst = (ms > worst) ? ms : worst;
+  }
+  TEST_ASSERT_EQUAL_UINT32(SLOTS * ROUNDS, acknowledged(tracker) + tracker.failedCount());
+  TEST_ASSERT_TRUE(tracker.failedCount() < SLOTS * ROUNDS / 20);
+  TEST_ASSERT_TRUE(tracker.retriedCount(0) < acknowledged(tracker)); // some needed resends
+  TEST_ASSERT_TRUE(worst < 3200 + 2 * LINK_DELAY_MS);                // the last resend, and its echo
+  TEST_ASSERT_EQUAL_UINT32(0, tracker.untrackedCount());
+}
+
+// ***************************************************************
+// a sender sending again replaces its command in place, keeping what to go back to; no slot, not tracked;
+// a forgotten command frees its slot
+// ***************************************************************
+void test_replace_in_place()
+{
+  static Tracker tracker;
+  Sender senders[SLOTS + 1];
+  TEST_ASSERT_TRUE(tracker.track(&senders[0], 1, 0, 0, 0));
+  tracker.due(0, FIRST_MS); // one resend
+  TEST_ASSERT_TRUE(tracker.track(&senders[0], 0, 1, 0, 100));
+  TEST_ASSERT_EQUAL(0, tracker.command(0).value);
+  TEST_ASSERT_EQUAL(0, tracker.command(0).previous);
+  TEST_ASSERT_EQUAL(0, tracker.command(0).retries);
+  TEST_ASSERT_EQUAL(Tracker::ACK_WAIT, tracker.due(0, 100 + FIRST_MS - 1));
+  for (int s = 1; s < SLOTS; s++)
+  {
+    TEST_ASSERT_TRUE(tracker.track(&senders[s], 1, 0, 0, 100));
+    TEST_ASSERT_TRUE(tracker.command(s).sender == &senders[s]);
+  }
+  TEST_ASSERT_FALSE(tracker.track(&senders[SLOTS], 1, 0, 0, 100));
+  TEST_ASSERT_EQUAL_UINT32(1, tracker.untrackedCount());
+  tracker.forget(3); // as a newer /load takes over: a free slot, and neither acknowledged nor failed
+  TEST_ASSERT_TRUE(tracker.track(&senders[SLOTS], 1, 0, 0, 100));
+  TEST_ASSERT_TRUE(tracker.command(3).sender == &senders[SLOTS]);
+  TEST_ASSERT_EQUAL_UINT32(0, tracker.failedCount());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_no_loss);
+  RUN_TEST(test_backoff_then_give_up);
+  RUN_TEST(test_lossy_link);
+  RUN_TEST(test_replace_in_place);
+  return UNITY_END();
+}
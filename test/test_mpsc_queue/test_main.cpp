@@ -0,0 +1,188 @@
+// ***************************************************************
+// MpscQueue on the PC, under ThreadSanitizer: pio test -e native
+// - producers stand in for the tasks that queue LED commands and packets, the consumer for ledPoll or the TX owner
+// ***************************************************************
+#include <unity.h>
+
+#include <atomic>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "../../src/MpscQueue.h"
+
+#define PRODUCERS 4
+#define ITEMS_PER_PRODUCER 100000
+
+struct Item
+{
+  uint8_t producer;
+  uint32_t seq;
+};
+
+// as Transport queues a TxPacket: big enough that a torn or stale copy would show
+struct Packet
+{
+  uint8_t producer;
+  uint32_t seq;
+  uint8_t data[64]; // every byte the low byte of seq + producer
+};
+
+void setUp() {}
+void tearDown() {}
+
+// ***************************************************************
+// one task: first in, first out; full and empty say so
+// ***************************************************************
+void test_fifo_full_empty()
+{
+  MpscQueue<Item, 4> queue;
+  Item item;
+  TEST_ASSERT_FALSE(queue.pop(item));
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    TEST_ASSERT_TRUE(queue.push(Item{0, i}));
+  }
+  TEST_ASSERT_FALSE(queue.push(Item{0, 4}));
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    TEST_ASSERT_TRUE(queue.pop(item));
+    TEST_ASSERT_EQUAL_UINT32(i, item.seq);
+  }
+  TEST_ASSERT_FALSE(queue.pop(item));
+  // round again, past the end of the slots
+  for (uint32_t i = 0; i < 10; i++)
+  {
+    TEST_ASSERT_TRUE(queue.push(Item{0, i}));
+    TEST_ASSERT_TRUE(queue.pop(item));
+    TEST_ASSERT_EQUAL_UINT32(i, item.seq);
+  }
+}
+
+// ***************************************************************
+// many producers, one consumer: nothing lost, nothing twice, each producer's items in order
+// ***************************************************************
+void test_producers_consumer()
+{
+  static MpscQueue<Item, 32> queue;
+  std::vector<std::thread> producers;
+  for (uint8_t p = 0; p < PRODUCERS; p++)
+  {
+    producers.emplace_back([p]() {
+      for (uint32_t i = 0; i < ITEMS_PER_PRODUCER; i++)
+      {
+        while (!queue.push(Item{p, i}))
+        {
+          std::this_thread::yield(); // full; as ledQueuePush would count a drop, but here we want them all
+        }
+      }
+    });
+  }
+
+  uint32_t next[PRODUCERS] = {0};
+  uint32_t received = 0;
+  bool inOrder = true;
+  Item item;
+  while (received < PRODUCERS * ITEMS_PER_PRODUCER)
+  {
+    if (!queue.pop(item))
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    inOrder &= (item.producer < PRODUCERS && item.seq == next[item.producer]);
+    next[item.producer % PRODUCERS]++;
+    received++;
+  }
+  for (auto &producer : producers)
+  {
+    producer.join();
+  }
+  TEST_ASSERT_TRUE(inOrder);
+  TEST_ASSERT_FALSE(queue.pop(item));
+}
+
+// ***************************************************************
+// the way Transport uses it: push, then count the depth; the TX owner reads the depth, but only sends what
+// pop() hands it, as a producer may have counted its packet before the slot is published
+// ***************************************************************
+void test_transport_depth()
+{
+  static MpscQueue<Packet, 4> queue;
+  static std::atomic<uint32_t> depth(0);
+  std::atomic<uint32_t> dropped(0);
+  std::vector<std::thread> producers;
+  for (uint8_t p = 0; p < PRODUCERS; p++)
+  {
+    producers.emplace_back([p, &dropped]() {
+      Packet packet;
+      packet.producer = p;
+      for (uint32_t i = 0; i < ITEMS_PER_PRODUCER / 10; i++)
+      {
+        packet.seq = i;
+        memset(packet.data, (uint8_t)(i + p), sizeof(packet.data));
+        if (queue.push(packet))
+        {
+          depth++;
+        }
+        else
+        {
+          dropped++; // queue full: Transport::countDropped
+        }
+      }
+    });
+  }
+
+  uint32_t sent = 0;
+  uint32_t notReady = 0;
+  int32_t last[PRODUCERS] = {-1, -1, -1, -1};
+  bool intact = true;
+  Packet packet;
+  std::atomic<bool> done(false);
+  std::thread joiner([&producers, &done]() {
+    for (auto &producer : producers)
+    {
+      producer.join();
+    }
+    done = true;
+  });
+  for (;;)
+  {
+    bool finished = done; // read before the depth, so nothing pushed before it is missed
+    if (depth == 0)
+    {
+      if (finished)
+      {
+        break;
+      }
+      std::this_thread::yield();
+      continue;
+    }
+    if (!queue.pop(packet))
+    {
+      notReady++; // counted, not published yet: try again rather than send the old packet
+      continue;
+    }
+    depth--;
+    sent++;
+    intact &= (packet.producer < PRODUCERS && (int32_t)packet.seq > last[packet.producer]);
+    last[packet.producer % PRODUCERS] = packet.seq;
+    for (size_t b = 0; b < sizeof(packet.data); b++)
+    {
+      intact &= (packet.data[b] == (uint8_t)(packet.seq + packet.producer));
+    }
+  }
+  joiner.join();
+  TEST_ASSERT_TRUE(intact);
+  TEST_ASSERT_EQUAL_UINT32(PRODUCERS * (ITEMS_PER_PRODUCER / 10), sent + dropped);
+  TEST_ASSERT_FALSE(queue.pop(packet));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_fifo_full_empty);
+  RUN_TEST(test_producers_consumer);
+  RUN_TEST(test_transport_depth);
+  return UNITY_END();
+}